@@ -1,151 +1,79 @@
-
 #include <iostream>
-#include <cstddef>
-#include <functional>
-
-template<typename T, size_t C>
-class DotProduct {
-public:
-    static T evaluate(const T *array1, const T *array2) {
-        const T first = DotProduct<T, 1>::evaluate(array1, array2);
-        const T remaining = DotProduct<T, C - 1>::evaluate(array1 + 1, array2 + 1);
+#include <vector>
+#include <future>
+#include <cassert>
 
-        return first + remaining;
-    }
-};
+#include "expressions.hpp"
+#include "pipeline.hpp"
 
-// dot product core
-template<typename T>
-class DotProduct<T, 1> {
-public:
-    static T evaluate(const T *array1, const T *array2) {
-        return array1[0] * array2[0];
-    }
+// a request to integrate the shader over [from, to]
+struct Range {
+    double from;
+    double to;
 };
 
-namespace lazy {
-    template<typename T, size_t C> 
-    inline T dot(const T* array1, const T* array2) {
-        return DotProduct<T, C>::evaluate(array1, array2);
-    }
-}
-
-
-// arithmetic expressions
-
-// Literal (AKA constant)
-class Literal {
-public:
-    Literal(const double value) 
-        : m_value(value) {}
-    
-    double evaluate(double) const {
-        return m_value;
-    }
-
-private:
-    const double m_value;
-};
+int main() {
+    static constexpr float array1[] = {1.0f, 1.0f, 1.0f};
+    static constexpr float array2[] = {1.5f, 1.0f, 1.0f};
 
-template<typename T>
-class Identity {
-public:
-    T evaluate(T value) const {
-        return value;
-    }
-};
+    constexpr float result = lazy::dot<float, 3>(array1, array2);
 
-// expression traits
-template<typename Expression> struct ExpressionTraits {
-    typedef Expression expression_type;
-};
+    std::cout << result  << std::endl;
 
-template<> struct ExpressionTraits<double> {
-    typedef Literal expression_type;
-};
+    Identity<double> x;
 
-template<> struct ExpressionTraits<int> {
-    typedef Literal expression_type;
-};
+    double result2 = integrate( x / (1.0 + x), 1.0, 5.0, 10);
 
-template<> struct ExpressionTraits<float> {
-    typedef Literal expression_type;
-};
+    std::cout << result2 << std::endl;
 
-// expressions
-template<typename Expression, typename UnaryOperation>
-class UnaryExpression {
-public:
-    UnaryExpression(Expression e, UnaryOperation op=UnaryOperation()) 
-        : m_e(e), m_op(op) {}
+    // a shader, written as a single expression over texgen operations
+    const double knots[] = {0.0, 0.0, 0.3, 1.0, 0.6, 1.0, 1.0};
+    const texgen::spline_curve<double> ramp(7, knots);
 
-    double evaluate(double value) const {
-        return m_op(m_e.evaluate(value));
-    }
+    auto shader = lazy::spline(ramp, lazy::smoothstep(1.0, 4.0, x) * (0.5 + 0.5 * lazy::sin(x * 3.0)));
 
-private:
-    Expression m_e;
-    UnaryOperation m_op;
-};
+    double result3 = integrate(shader, 1.0, 5.0, 10);
 
-template<typename Expression1, typename Expression2, typename BinaryOperation>
-class BinaryExpression {
-public:
-    BinaryExpression(Expression1 e1, Expression2 e2, BinaryOperation op=BinaryOperation()) 
-        : m_e1(e1), m_e2(e2), m_op(op) {}
+    std::cout << result3 << std::endl;
 
-    double evaluate(double value) const {
-        return m_op(m_e1.evaluate(value), m_e2.evaluate(value));
-    }
+    // a smoothstep curve, tabulated by the compiler
+    constexpr auto curve = lazy::tabulate<65>(lazy::smoothstep(0.25, 0.75, Identity<double>()));
+    static_assert(curve[0] == 0.0 && curve[32] == 0.5 && curve[64] == 1.0, "smoothstep curve");
 
-private:
-    typename ExpressionTraits<Expression1>::expression_type m_e1;
-    typename ExpressionTraits<Expression2>::expression_type m_e2;
-    BinaryOperation m_op;
-};
+    std::cout << curve[16] << " " << curve.lookup(0.6) << std::endl;
 
-template <typename Expression1, typename Expression2>
-BinaryExpression<Expression1, Expression2, std::plus<double>> operator+ (Expression1 e1, Expression2 e2) {
-    return BinaryExpression<Expression1, Expression2, std::plus<double>>(e1, e2);
-}
+    // many small integration requests, submitted asynchronously and evaluated in batches
+    auto integrateShader = [&shader](const Range *ranges, double *results, const size_t count) {
+        for (size_t i=0; i<count; i++) {
+            results[i] = integrate(shader, ranges[i].from, ranges[i].to, 1000);
+        }
+    };
 
-template <typename Expression1, typename Expression2>
-BinaryExpression<Expression1, Expression2, std::multiplies<double>> operator*(Expression1 e1, Expression2 e2) {
-    return BinaryExpression<Expression1, Expression2, std::multiplies<double>>(e1, e2);
-}
+    lazy::LatencyRecorder latencies;
 
+    {
+        lazy::BatchPipeline<Range, double> pipeline(integrateShader, 4, 256, 32, &latencies);
+        std::vector<std::future<double>> futures;
 
-template <typename Expression1, typename Expression2>
-BinaryExpression<Expression1, Expression2, std::divides<double>> operator/(Expression1 e1, Expression2 e2) {
-    return BinaryExpression<Expression1, Expression2, std::divides<double>>(e1, e2);
-}
+        for (int i=0; i<10000; i++) {
+            const Range range = {1.0, 1.0 + 0.04*(i % 100 + 1)};
+            futures.push_back(pipeline.submit(range));
+        }
 
-template<typename Expression>
-double integrate(Expression e, const double from, const double to, const size_t n) {
-    const double step = (to - from) / n;
+        for (int i=0; i<10000; i++) {
+            const double value = futures[i].get();
+            const double expected = integrate(shader, 1.0, 1.0 + 0.04*(i % 100 + 1), 1000);
 
-    double sum = 0.0;
-    
-    for (double i=from + step*0.5; i<to; i+=step) {
-        sum += e.evaluate(i);
+            assert(value == expected);
+            (void)value;
+            (void)expected;
+        }
     }
 
-    return sum;
-}
+    // the workers are joined by now, so the latencies and the trace are complete
+    std::cout << latencies.count() << " requests, latency p50 " << latencies.percentile(0.5) << " us, p99 " << latencies.percentile(0.99) << " us" << std::endl;
 
-int main() {
-    const float array1[] = {1.0f, 1.0f, 1.0f};
-    const float array2[] = {1.5f, 1.0f, 1.0f};
-
-    const float result = lazy::dot<float, 3>(array1, array2);
-
-    std::cout << result  << std::endl;
-
-    Identity<double> x;
-
-    double result2 = integrate( x / (1.0 + x), 1.0, 5.0, 10);
-
-    std::cout << result2 << std::endl;
+    TRACE_DUMP("ExpressionTemplates01.trace.json");
 
     return 0;
 }
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <cmath>
+
+#include "texgen.hpp"
+#include "trace.hpp"
+
+template<typename T, size_t C>
+class DotProduct {
+public:
+    static constexpr T evaluate(const T *array1, const T *array2) {
+        const T first = DotProduct<T, 1>::evaluate(array1, array2);
+        const T remaining = DotProduct<T, C - 1>::evaluate(array1 + 1, array2 + 1);
+
+        return first + remaining;
+    }
+};
+
+// dot product core
+template<typename T>
+class DotProduct<T, 1> {
+public:
+    static constexpr T evaluate(const T *array1, const T *array2) {
+        return array1[0] * array2[0];
+    }
+};
+
+namespace lazy {
+    template<typename T, size_t C> 
+    constexpr T dot(const T* array1, const T* array2) {
+        return DotProduct<T, C>::evaluate(array1, array2);
+    }
+}
+
+
+// arithmetic expressions
+
+// Literal (AKA constant)
+class Literal {
+public:
+    constexpr Literal(const double value) 
+        : m_value(value) {}
+    
+    constexpr double evaluate(double) const {
+        return m_value;
+    }
+
+private:
+    const double m_value;
+};
+
+template<typename T>
+class Identity {
+public:
+    constexpr T evaluate(T value) const {
+        return value;
+    }
+};
+
+// expression traits
+template<typename Expression> struct ExpressionTraits {
+    typedef Expression expression_type;
+};
+
+template<> struct ExpressionTraits<double> {
+    typedef Literal expression_type;
+};
+
+template<> struct ExpressionTraits<int> {
+    typedef Literal expression_type;
+};
+
+template<> struct ExpressionTraits<float> {
+    typedef Literal expression_type;
+};
+
+// expressions
+template<typename Expression, typename UnaryOperation>
+class UnaryExpression {
+public:
+    constexpr UnaryExpression(Expression e, UnaryOperation op=UnaryOperation()) 
+        : m_e(e), m_op(op) {}
+
+    constexpr double evaluate(double value) const {
+        return m_op(m_e.evaluate(value));
+    }
+
+private:
+    typename ExpressionTraits<Expression>::expression_type m_e;
+    UnaryOperation m_op;
+};
+
+template<typename Expression1, typename Expression2, typename BinaryOperation>
+class BinaryExpression {
+public:
+    constexpr BinaryExpression(Expression1 e1, Expression2 e2, BinaryOperation op=BinaryOperation()) 
+        : m_e1(e1), m_e2(e2), m_op(op) {}
+
+    constexpr double evaluate(double value) const {
+        return m_op(m_e1.evaluate(value), m_e2.evaluate(value));
+    }
+
+private:
+    typename ExpressionTraits<Expression1>::expression_type m_e1;
+    typename ExpressionTraits<Expression2>::expression_type m_e2;
+    BinaryOperation m_op;
+};
+
+template<typename Expression1, typename Expression2, typename Expression3, typename TernaryOperation>
+class TernaryExpression {
+public:
+    constexpr TernaryExpression(Expression1 e1, Expression2 e2, Expression3 e3, TernaryOperation op=TernaryOperation()) 
+        : m_e1(e1), m_e2(e2), m_e3(e3), m_op(op) {}
+
+    constexpr double evaluate(double value) const {
+        return m_op(m_e1.evaluate(value), m_e2.evaluate(value), m_e3.evaluate(value));
+    }
+
+private:
+    typename ExpressionTraits<Expression1>::expression_type m_e1;
+    typename ExpressionTraits<Expression2>::expression_type m_e2;
+    typename ExpressionTraits<Expression3>::expression_type m_e3;
+    TernaryOperation m_op;
+};
+
+// expression nodes
+template<typename T> struct IsExpression : std::false_type {};
+
+template<> struct IsExpression<Literal> : std::true_type {};
+
+template<typename T> struct IsExpression<Identity<T>> : std::true_type {};
+
+template<typename Expression, typename UnaryOperation>
+struct IsExpression<UnaryExpression<Expression, UnaryOperation>> : std::true_type {};
+
+template<typename Expression1, typename Expression2, typename BinaryOperation>
+struct IsExpression<BinaryExpression<Expression1, Expression2, BinaryOperation>> : std::true_type {};
+
+template<typename Expression1, typename Expression2, typename Expression3, typename TernaryOperation>
+struct IsExpression<TernaryExpression<Expression1, Expression2, Expression3, TernaryOperation>> : std::true_type {};
+
+// the operators only take expressions, and the numbers that the traits turn into
+// literals, so they leave iterators, vectors and the like to their own operators
+template<typename Expression1, typename Expression2>
+using EnableIfExpressions = typename std::enable_if<
+    IsExpression<typename ExpressionTraits<Expression1>::expression_type>::value &&
+    IsExpression<typename ExpressionTraits<Expression2>::expression_type>::value>::type;
+
+template <typename Expression1, typename Expression2, typename = EnableIfExpressions<Expression1, Expression2>>
+constexpr BinaryExpression<Expression1, Expression2, std::plus<double>> operator+ (Expression1 e1, Expression2 e2) {
+    return BinaryExpression<Expression1, Expression2, std::plus<double>>(e1, e2);
+}
+
+template <typename Expression1, typename Expression2, typename = EnableIfExpressions<Expression1, Expression2>>
+constexpr BinaryExpression<Expression1, Expression2, std::multiplies<double>> operator*(Expression1 e1, Expression2 e2) {
+    return BinaryExpression<Expression1, Expression2, std::multiplies<double>>(e1, e2);
+}
+
+
+template <typename Expression1, typename Expression2, typename = EnableIfExpressions<Expression1, Expression2>>
+constexpr BinaryExpression<Expression1, Expression2, std::divides<double>> operator/(Expression1 e1, Expression2 e2) {
+    return BinaryExpression<Expression1, Expression2, std::divides<double>>(e1, e2);
+}
+
+// texgen operations, as expression nodes. the functors forward to the texgen
+// templates, so a shader written as an expression inlines into a single evaluate().
+namespace lazy {
+    struct Sin { double operator()(double x) const { return texgen::sin(x); } };
+    struct Cos { double operator()(double x) const { return texgen::cos(x); } };
+    struct Abs { constexpr double operator()(double x) const { return texgen::abs(x); } };
+    struct Floor { constexpr double operator()(double x) const { return texgen::floor(x); } };
+
+    struct Step { constexpr double operator()(double a, double x) const { return texgen::step(a, x); } };
+    struct Mod { constexpr double operator()(double a, double b) const { return texgen::mod(a, b); } };
+    struct Min { constexpr double operator()(double a, double b) const { return texgen::min(a, b); } };
+    struct Max { constexpr double operator()(double a, double b) const { return texgen::max(a, b); } };
+
+    struct Pulse { constexpr double operator()(double a, double b, double x) const { return texgen::pulse(a, b, x); } };
+    struct Clamp { constexpr double operator()(double x, double a, double b) const { return texgen::clamp(x, a, b); } };
+    struct Smoothstep { constexpr double operator()(double a, double b, double x) const { return texgen::smoothstep(a, b, x); } };
+    struct Mix { constexpr double operator()(double a, double b, double t) const { return texgen::mix(a, b, t); } };
+
+    // the curve is referenced, not copied, and must outlive the expression
+    class Spline {
+    public:
+        Spline(const texgen::spline_curve<double> &curve) : m_curve(&curve) {}
+
+        double operator()(double x) const {
+            return (*m_curve)(x);
+        }
+
+    private:
+        const texgen::spline_curve<double> *m_curve;
+    };
+
+    template<typename E> UnaryExpression<E, Sin> sin(E e) { return UnaryExpression<E, Sin>(e); }
+    template<typename E> UnaryExpression<E, Cos> cos(E e) { return UnaryExpression<E, Cos>(e); }
+    template<typename E> constexpr UnaryExpression<E, Abs> abs(E e) { return UnaryExpression<E, Abs>(e); }
+    template<typename E> constexpr UnaryExpression<E, Floor> floor(E e) { return UnaryExpression<E, Floor>(e); }
+
+    template<typename E1, typename E2>
+    constexpr BinaryExpression<E1, E2, Step> step(E1 a, E2 x) {
+        return BinaryExpression<E1, E2, Step>(a, x);
+    }
+
+    template<typename E1, typename E2>
+    constexpr BinaryExpression<E1, E2, Mod> mod(E1 a, E2 b) {
+        return BinaryExpression<E1, E2, Mod>(a, b);
+    }
+
+    template<typename E1, typename E2>
+    constexpr BinaryExpression<E1, E2, Min> min(E1 a, E2 b) {
+        return BinaryExpression<E1, E2, Min>(a, b);
+    }
+
+    template<typename E1, typename E2>
+    constexpr BinaryExpression<E1, E2, Max> max(E1 a, E2 b) {
+        return BinaryExpression<E1, E2, Max>(a, b);
+    }
+
+    template<typename E1, typename E2, typename E3>
+    constexpr TernaryExpression<E1, E2, E3, Pulse> pulse(E1 a, E2 b, E3 x) {
+        return TernaryExpression<E1, E2, E3, Pulse>(a, b, x);
+    }
+
+    template<typename E1, typename E2, typename E3>
+    constexpr TernaryExpression<E1, E2, E3, Clamp> clamp(E1 x, E2 a, E3 b) {
+        return TernaryExpression<E1, E2, E3, Clamp>(x, a, b);
+    }
+
+    template<typename E1, typename E2, typename E3>
+    constexpr TernaryExpression<E1, E2, E3, Smoothstep> smoothstep(E1 a, E2 b, E3 x) {
+        return TernaryExpression<E1, E2, E3, Smoothstep>(a, b, x);
+    }
+
+    template<typename E1, typename E2, typename E3>
+    constexpr TernaryExpression<E1, E2, E3, Mix> mix(E1 a, E2 b, E3 t) {
+        return TernaryExpression<E1, E2, E3, Mix>(a, b, t);
+    }
+
+    template<typename E>
+    UnaryExpression<E, Spline> spline(const texgen::spline_curve<double> &curve, E x) {
+        return UnaryExpression<E, Spline>(x, Spline(curve));
+    }
+
+    // expression as a function object, for texgen::make_table
+    template<typename Expression>
+    class Function {
+    public:
+        constexpr Function(Expression e) : m_e(e) {}
+
+        constexpr double operator()(const double x) const {
+            return m_e.evaluate(x);
+        }
+
+    private:
+        typename ExpressionTraits<Expression>::expression_type m_e;
+    };
+
+    // samples an expression into a table over [from, to], at compile time when the
+    // expression only uses constexpr nodes
+    template<std::size_t N, typename Expression>
+    constexpr texgen::table<double, N> tabulate(Expression e, const double from = 0.0, const double to = 1.0) {
+        return texgen::make_table<double, N>(Function<Expression>(e), from, to);
+    }
+
+    // evaluates an expression over a batch of inputs
+    template<typename Expression>
+    void evaluate(const Expression &e, const double *values, double *results, const size_t n) {
+        TRACE_SCOPE("lazy::evaluate");
+
+        for (size_t i=0; i<n; i++) {
+            results[i] = e.evaluate(values[i]);
+        }
+    }
+}
+
+template<typename Expression>
+double integrate(Expression e, const double from, const double to, const size_t n) {
+    TRACE_SCOPE("integrate");
+
+    const double step = (to - from) / n;
+
+    double sum = 0.0;
+    
+    for (double i=from + step*0.5; i<to; i+=step) {
+        sum += e.evaluate(i);
+    }
+
+    return sum;
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <array>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <exception>
+
+#include "trace.hpp"
+
+namespace lazy {
+    // latencies of completed requests, in microseconds. they are counted in a fixed
+    // histogram that splits every power of two in 'SubBuckets' buckets, so it takes
+    // the same memory however long the pipeline runs, and a percentile is off by at
+    // most half a bucket, about 3%.
+    class LatencyRecorder {
+    public:
+        static const int SubBuckets = 16;
+        static const int Octaves = 32;
+
+        LatencyRecorder() {
+            m_buckets.fill(0);
+        }
+
+        void record(const double microseconds) {
+            record(&microseconds, 1);
+        }
+
+        // a whole batch under one lock
+        void record(const double *microseconds, const std::size_t count) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            for (std::size_t i=0; i<count; i++) {
+                m_buckets[bucket(microseconds[i])]++;
+            }
+
+            m_count += count;
+        }
+
+        std::size_t count() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            return m_count;
+        }
+
+        // nearest rank percentile, for q in [0, 1], as the middle of its bucket
+        double percentile(const double q) const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            if (m_count == 0) {
+                return 0.0;
+            }
+
+            const std::size_t rank = std::min(m_count - 1, static_cast<std::size_t>(q * m_count));
+            std::size_t below = 0;
+
+            for (std::size_t i=0; i<m_buckets.size(); i++) {
+                below += m_buckets[i];
+
+                if (below > rank) {
+                    return middle(i);
+                }
+            }
+
+            return middle(m_buckets.size() - 1);
+        }
+
+    private:
+        // bucket 0 holds everything under a microsecond, and the last one everything
+        // past the top octave
+        static std::size_t bucket(const double microseconds) {
+            if (!(microseconds >= 1.0)) {
+                return 0;
+            }
+
+            int exponent = 0;
+            const double mantissa = std::frexp(microseconds, &exponent);
+
+            const int octave = std::min(exponent - 1, Octaves - 1);
+            const int sub = std::min(static_cast<int>((2.0*mantissa - 1.0) * SubBuckets), SubBuckets - 1);
+
+            return 1 + static_cast<std::size_t>(octave*SubBuckets + sub);
+        }
+
+        static double middle(const std::size_t bucket) {
+            if (bucket == 0) {
+                return 0.5;
+            }
+
+            const int octave = static_cast<int>(bucket - 1) / SubBuckets;
+            const int sub = static_cast<int>(bucket - 1) % SubBuckets;
+
+            return std::ldexp(1.0 + (sub + 0.5) / SubBuckets, octave);
+        }
+
+        mutable std::mutex m_mutex;
+        std::array<std::uint64_t, 1 + Octaves*SubBuckets> m_buckets;
+        std::size_t m_count = 0;
+    };
+
+    // evaluates independent requests asynchronously on a pool of worker threads.
+    //
+    // every request submitted to a pipeline goes through the same batch function, so
+    // any of them can share a batch. a worker takes whatever is queued, up to
+    // 'maxBatch' requests: a lone request runs right away, while a burst gets evaluated
+    // in large batches. the queue holds at most 'capacity' requests, and submit()
+    // blocks while it is full, so producers can't outrun the workers.
+    //
+    // the latencies, from submission to the result being available, go to the
+    // recorder if there is one. it has to outlive the pipeline, and is complete once
+    // the pipeline is destroyed.
+    template<typename Request, typename Result>
+    class BatchPipeline {
+    public:
+        typedef std::function<void(const Request *requests, Result *results, std::size_t count)> BatchFunction;
+
+        BatchPipeline(BatchFunction function, const std::size_t threads, const std::size_t capacity, const std::size_t maxBatch, LatencyRecorder *latencies = nullptr)
+            : m_function(function), m_capacity(capacity), m_maxBatch(maxBatch), m_latencies(latencies) {
+
+            assert(threads > 0 && capacity > 0 && maxBatch > 0);
+
+            for (std::size_t i=0; i<threads; i++) {
+                m_threads.push_back(std::thread(&BatchPipeline::run, this));
+            }
+        }
+
+        BatchPipeline(const BatchPipeline &) = delete;
+        BatchPipeline &operator=(const BatchPipeline &) = delete;
+
+        // the requests still queued get evaluated before the workers exit
+        ~BatchPipeline() {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_closing = true;
+            }
+
+            m_notEmpty.notify_all();
+
+            for (std::thread &thread : m_threads) {
+                thread.join();
+            }
+        }
+
+        std::future<Result> submit(const Request &request) {
+            Pending pending;
+            pending.request = request;
+            pending.submitted = Clock::now();
+
+            std::future<Result> future = pending.promise.get_future();
+
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+
+                m_notFull.wait(lock, [this]() { return m_queue.size() < m_capacity; });
+                m_queue.push_back(std::move(pending));
+            }
+
+            m_notEmpty.notify_one();
+
+            return future;
+        }
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        struct Pending {
+            Request request;
+            std::promise<Result> promise;
+            Clock::time_point submitted;
+        };
+
+        void run() {
+            std::vector<Pending> batch;
+            std::vector<Request> requests;
+            std::vector<Result> results;
+            std::vector<double> latencies;
+
+            for (;;) {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+
+                    m_notEmpty.wait(lock, [this]() { return !m_queue.empty() || m_closing; });
+
+                    if (m_queue.empty()) {
+                        return;
+                    }
+
+                    const std::size_t count = std::min(m_queue.size(), m_maxBatch);
+
+                    for (std::size_t i=0; i<count; i++) {
+                        batch.push_back(std::move(m_queue.front()));
+                        m_queue.pop_front();
+                    }
+                }
+
+                m_notFull.notify_all();
+
+                requests.clear();
+
+                for (const Pending &pending : batch) {
+                    requests.push_back(pending.request);
+                }
+
+                results.resize(batch.size());
+
+                {
+                    TRACE_SCOPE("BatchPipeline batch");
+                    TRACE_COUNTER("batch size", static_cast<std::int64_t>(batch.size()));
+
+                    std::exception_ptr error;
+
+                    try {
+                        m_function(requests.data(), results.data(), batch.size());
+                    } catch (...) {
+                        error = std::current_exception();
+                    }
+
+                    // recorded before the results are published, so the latencies of
+                    // every completed future are in
+                    if (m_latencies) {
+                        const Clock::time_point completed = Clock::now();
+
+                        latencies.clear();
+
+                        for (const Pending &pending : batch) {
+                            latencies.push_back(std::chrono::duration<double, std::micro>(completed - pending.submitted).count());
+                        }
+
+                        m_latencies->record(latencies.data(), latencies.size());
+                    }
+
+                    // a failed batch fails all of its requests
+                    for (std::size_t i=0; i<batch.size(); i++) {
+                        if (error) {
+                            batch[i].promise.set_exception(error);
+                        } else {
+                            batch[i].promise.set_value(results[i]);
+                        }
+                    }
+                }
+
+                batch.clear();
+            }
+        }
+
+    private:
+        BatchFunction m_function;
+        std::size_t m_capacity;
+        std::size_t m_maxBatch;
+
+        std::mutex m_mutex;
+        std::condition_variable m_notEmpty;
+        std::condition_variable m_notFull;
+        std::deque<Pending> m_queue;
+        bool m_closing = false;
+
+        LatencyRecorder *m_latencies;
+        std::vector<std::thread> m_threads;
+    };
+}
@@ -1,115 +1,235 @@
 
 #include <iostream>
 #include <cassert>
+#include <cmath>
+#include <vector>
+#include <thread>
+#include <cstdio>
 
-namespace texgen {
-    template<typename T>
-    T step(const T a, const T x) {
-        return static_cast<T>(a >= x);
+#include "texgen.hpp"
+
+// knots of the color ramp
+constexpr float knots[] = {0.0f, 0.0f, 0.2f, 0.9f, 0.4f, 1.0f, 1.0f};
+
+struct color_ramp {
+    constexpr float operator() (const float x) const {
+        return texgen::spline(x, 7, knots);
+    }
+};
+
+int main() {
+    // shade a row of pixels, one packet at a time, and check it against the scalar path
+    const int width = 64;
+
+    for (int x=0; x<width; x+=texgen::float8::size()) {
+        texgen::float8 u;
+
+        for (int i=0; i<texgen::float8::size(); i++) {
+            u[i] = (x + i + 0.5f) / width;
+        }
+
+        const texgen::float8 value = texgen::smoothstep(texgen::float8(0.25f), texgen::float8(0.75f), texgen::mod(u*texgen::float8(3.0f), texgen::float8(1.0f)));
+
+        for (int i=0; i<texgen::float8::size(); i++) {
+            const float expected = texgen::smoothstep(0.25f, 0.75f, texgen::mod(u[i]*3.0f, 1.0f));
+
+            assert(std::abs(value[i] - expected) < 1e-6f);
+            (void)expected;
+
+            std::cout << value[i] << " ";
+        }
     }
 
-    template<typename T>
-    T pulse(const T a, const T b, const T x) {
-        return step(a, x) - step(b, x);
+    std::cout << std::endl;
+
+    // the packet path of the noise must agree with the scalar one
+    const texgen::gradient_noise noise(42);
+
+    texgen::float8 nx, ny;
+
+    for (int i=0; i<texgen::float8::size(); i++) {
+        nx[i] = 0.37f*i - 1.1f;
+        ny[i] = 0.21f*i + 3.4f;
     }
 
-    template<typename T>
-    T clamp(const T x, const T a, const T b) {
-        return x < a ? a : (x > b ? b: x);
+    const texgen::float8 turbulence = noise.turbulence(nx, ny, texgen::float8(0.5f), 4);
+
+    for (int i=0; i<texgen::float8::size(); i++) {
+        const float expected = noise.turbulence(nx[i], ny[i], 0.5f, 4);
+
+        assert(std::abs(turbulence[i] - expected) < 1e-6f);
+        (void)expected;
+
+        std::cout << turbulence[i] << " ";
     }
 
-    template<typename T>
-    T min(const T a, const T b) {
-        return a < b ? a : b;
+    std::cout << std::endl;
+
+    // a color ramp, precomputed once and evaluated over a whole row
+    const texgen::spline_curve<float> ramp(7, knots);
+
+    float u[width], ramped[width];
+
+    for (int i=0; i<width; i++) {
+        u[i] = i / float(width - 1);
     }
 
-    template<typename T>
-    T max(const T a, const T b) {
-        return a < b ? b : a;
+    ramp.evaluate(u, ramped, width);
+
+    for (int i=0; i<width; i++) {
+        assert(std::abs(ramped[i] - texgen::spline(u[i], 7, knots)) < 1e-5f);
     }
 
-    template<typename T>
-    T abs(const T x) {
-        return (x < T(0) ? -x : x);
+    std::cout << ramped[0] << " " << ramped[width/2] << " " << ramped[width - 1] << std::endl;
+
+    // the same ramp, tabulated by the compiler
+    static constexpr texgen::table<float, 256> baked = texgen::make_table<float, 256>(color_ramp());
+    static_assert(texgen::abs(baked[0]) < 1e-6f && texgen::abs(baked[255] - 1.0f) < 1e-6f, "ramp endpoints");
+
+    for (int i=0; i<width; i++) {
+        assert(std::abs(baked.lookup(u[i]) - ramped[i]) < 1e-3f);
     }
 
-    template<typename T>
-    T smoothstep(const T a, const T b, const T x) {
-        if (a < x) {
-            return T(0);
-        } 
+    // polynomial sine tiers, evaluated in packets, against the library
+    float fast_error = 0.0f, precise_error = 0.0f;
 
-        if (x >= b) {
-            return 1;
+    for (int i=0; i<4096; i+=texgen::float8::size()) {
+        texgen::float8 angle;
+
+        for (int k=0; k<texgen::float8::size(); k++) {
+            angle[k] = (i + k - 2048) * 0.01f;
         }
 
-        const T x_ = (x - a) / (x - b);
+        const texgen::float8 fast = texgen::sin<texgen::fast>(angle);
+        const texgen::float8 precise = texgen::sin<texgen::precise>(angle);
 
-        return x_*x_ * (T(3) - 2*x_);
+        for (int k=0; k<texgen::float8::size(); k++) {
+            fast_error = texgen::max(fast_error, std::abs(fast[k] - std::sin(angle[k])));
+            precise_error = texgen::max(precise_error, std::abs(precise[k] - std::sin(angle[k])));
+        }
     }
 
-    template<typename T>
-    T mod(const T a, const T b) {
-        T result = a;
+    assert(fast_error < 1e-4f && precise_error < 1e-6f);
+    std::cout << "sin error: fast " << fast_error << ", precise " << precise_error << std::endl;
+
+    // one filtered sample per pixel against 64 point samples, for stripes of 1.3 pixels
+    float aliasing_error = 0.0f;
 
-        auto n = static_cast<int>(a / b);
+    for (int x=0; x<width; x++) {
+        const float filtered = texgen::filteredpulsetrain(0.6f, 1.3f, x + 0.5f, 1.0f);
 
-        result -= n*b;
+        float supersampled = 0.0f;
 
-        if (result < 0) {
-            result += b;
+        for (int s=0; s<64; s++) {
+            supersampled += texgen::step(0.6f, texgen::mod(x + (s + 0.5f) / 64, 1.3f)) / 64;
         }
 
-        return result;
+        aliasing_error = texgen::max(aliasing_error, std::abs(filtered - supersampled));
     }
 
-    template<typename T>
-    T cos(const T x) {
-        return std::cos(x);
+    assert(aliasing_error < 0.02f);
+    std::cout << "filtered pulse train vs 64x supersampling: " << aliasing_error << std::endl;
+
+    // a marble-like shader behind a tile cache, sampled from several threads
+    auto marble = [&noise, &ramp](const float u, const float v) {
+        return ramp(0.5f + 0.5f*texgen::sin(8.0f*u + 4.0f*noise.turbulence(4.0f*u, 4.0f*v, 5)));
+    };
+
+    // the budget holds 32 of the 85 tiles of the pyramid, so the walks force evictions
+    texgen::tile_cache<decltype(marble)> cache(marble, 256, 32, 128*1024);
+    std::vector<std::thread> threads;
+
+    for (int t=0; t<4; t++) {
+        threads.push_back(std::thread([&cache, &marble, t]() {
+            // every thread walks the whole pyramid twice, starting at a different level
+            for (int pass=0; pass<2*cache.levels(); pass++) {
+                const int level = (pass + t) % cache.levels();
+                const int size = 256 >> level;
+
+                for (int y=0; y<size; y++) {
+                    for (int x=0; x<size; x++) {
+                        const float u = (x + 0.5f) / size, v = (y + 0.5f) / size;
+                        const float value = cache.sample(u, v, level);
+
+                        assert(value == marble(u, v));
+                        (void)value;
+                    }
+                }
+            }
+        }));
     }
 
-    template<typename T>
-    T sin(const T x) {
-        return std::sin(x);
-    }
-    
-    template<typename T>
-    T floor(const T x) {
-        return std::floor(x);
+    for (std::thread &thread : threads) {
+        thread.join();
     }
 
-    template<typename T>
-    T spline(const T x, const int nknots, const T *knot) {
-        assert(nknots > 3);
+    const auto stats = cache.stats();
 
-        const T cr00 = -0.5; const T cr01 = 1.5; const T cr02 = -1.5; const T cr03 = 0.5; 
-        const T cr10 = 1.0; const T cr11 = -2.5; const T cr12 = 2.0; const T cr13 = -0.5;
-        const T cr20 = -0.5; const T cr21 = 0.0; const T cr22 = 0.5; const T cr23 = 0.0;
-        const T cr30 = 0.0; const T cr31 = 1.0; const T cr32 = 0.0; const T cr33 = 0.0;
+    assert(stats.evictions > 0);
 
-        const int nspans = nknots - 3;
+    std::cout << "tile cache: " << stats.hits << " hits, " << stats.misses << " misses, " << stats.evictions << " evictions, "
+              << stats.resident_tiles << "/" << stats.capacity_tiles << " tiles resident" << std::endl;
 
-        T xx = clamp(x, T(0), T(1)) * nspans;
+    // incremental rendering: the left half reads one parameter, the right half another
+    texgen::parameter_set parameters;
 
-        int span = static_cast<int>(xx);
+    const int frequency = parameters.add(8.0f);
+    const int scale = parameters.add(4.0f);
 
-        if (span >= nspans) {
-            span = nspans;
+    auto split = [&noise, frequency, scale](const texgen::shading_context &context, const float u, const float v) {
+        if (u < 0.5f) {
+            return 0.5f + 0.5f*texgen::sin<texgen::fast>(context[frequency] * (u + v));
         }
 
-        xx -= span;
-        knot += span;
+        return noise.fbm(context[scale] * u, context[scale] * v, 4);
+    };
+
+    texgen::incremental_renderer<decltype(split)> renderer(split, 256, 256, 32);
+
+    const int initial = renderer.render(parameters);
+    const int unchanged = renderer.render(parameters);
 
-        const T c3 = cr00*knot[0] + cr01*knot[1] + cr02*knot[2] + cr03*knot[3];
-        const T c2 = cr10*knot[0] + cr11*knot[1] + cr12*knot[2] + cr13*knot[3];
-        const T c1 = cr20*knot[0] + cr21*knot[1] + cr22*knot[2] + cr23*knot[3];
-        const T c0 = cr30*knot[0] + cr31*knot[1] + cr32*knot[2] + cr33*knot[3];
+    parameters.set(frequency, 12.0f);
+    const int changed = renderer.render(parameters);
 
-        return ((c3*xx + c2)*xx + c1)*xx + c0;
+    texgen::incremental_renderer<decltype(split)> reference(split, 256, 256, 32);
+    reference.render(parameters);
+
+    for (int i=0; i<256*256; i++) {
+        assert(renderer.pixels()[i] == reference.pixels()[i]);
     }
-}
 
-int main() {
+    std::cout << "incremental: " << initial << " tiles, then " << unchanged << " unchanged, then " << changed << " after a parameter change" << std::endl;
+
+    // stream the marble shader into a tiled file, and check a few tiles back
+    texgen::render_tiled(marble, 1000, 700, 64, "marble.tiled");
+
+    {
+        texgen::tiled_reader reader("marble.tiled");
+        std::vector<float> tile(64*64);
+
+        for (int ty=0; ty<(int)reader.header().tiles_y; ty+=5) {
+            for (int tx=0; tx<(int)reader.header().tiles_x; tx+=3) {
+                reader.read_tile(tx, ty, tile.data());
+
+                for (int j=0; j<64; j++) {
+                    for (int i=0; i<64; i++) {
+                        const int x = tx*64 + i, y = ty*64 + j;
+                        const float expected = (x < 1000 && y < 700) ? marble((x + 0.5f) / 1000, (y + 0.5f) / 700) : 0.0f;
+
+                        assert(tile[j*64 + i] == expected);
+                        (void)expected;
+                    }
+                }
+            }
+        }
+
+        std::cout << "tiled file: " << reader.header().tiles_x << "x" << reader.header().tiles_y << " tiles" << std::endl;
+    }
+
+    std::remove("marble.tiled");
+
+    TRACE_DUMP("ProceduralTexture01.trace.json");
 
     return 0;
 }
@@ -0,0 +1,1601 @@
+
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstdio>
+#include <string>
+#include <stdexcept>
+#include <limits>
+#include <type_traits>
+
+#include "trace.hpp"
+
+// packet operations are tiny loops that only pay off once inlined into the shader
+// around them, so they don't leave it to the inliner's heuristics
+#if defined(_MSC_VER)
+#define TEXGEN_INLINE __forceinline
+#else
+#define TEXGEN_INLINE inline __attribute__((always_inline))
+#endif
+
+namespace texgen {
+    // integer with the width of a lane of T, for masks and conversions
+    template<typename T>
+    struct lane_integer {
+        typedef typename std::conditional<sizeof(T) <= 4, std::int32_t, std::int64_t>::type type;
+    };
+
+    // lane mask, produced by comparing two packets. a lane is all ones when the
+    // comparison holds, and zero otherwise.
+    template<typename T, int N>
+    struct mask {
+        typedef typename lane_integer<T>::type integer;
+
+        integer lanes[N];
+
+        TEXGEN_INLINE bool operator[] (const int i) const {
+            return lanes[i] != 0;
+        }
+
+        TEXGEN_INLINE friend mask operator& (const mask &m1, const mask &m2) {
+            mask result;
+            for (int i=0; i<N; i++) result.lanes[i] = m1.lanes[i] & m2.lanes[i];
+            return result;
+        }
+
+        TEXGEN_INLINE friend mask operator| (const mask &m1, const mask &m2) {
+            mask result;
+            for (int i=0; i<N; i++) result.lanes[i] = m1.lanes[i] | m2.lanes[i];
+            return result;
+        }
+    };
+
+    // packet of N lanes, shaded together. every operation is a fixed length loop
+    // without branches, so the compiler can map it to vector instructions.
+    template<typename T, int N>
+    struct packet {
+        typedef T value_type;
+
+        T lanes[N];
+
+        packet() {}
+
+        TEXGEN_INLINE packet(const T value) {
+            for (int i=0; i<N; i++) lanes[i] = value;
+        }
+
+        static int size() {
+            return N;
+        }
+
+        TEXGEN_INLINE T operator[] (const int i) const {
+            return lanes[i];
+        }
+
+        TEXGEN_INLINE T& operator[] (const int i) {
+            return lanes[i];
+        }
+
+        TEXGEN_INLINE friend packet operator- (const packet &p) {
+            packet result;
+            for (int i=0; i<N; i++) result.lanes[i] = -p.lanes[i];
+            return result;
+        }
+
+        TEXGEN_INLINE friend packet operator+ (const packet &p1, const packet &p2) {
+            packet result;
+            for (int i=0; i<N; i++) result.lanes[i] = p1.lanes[i] + p2.lanes[i];
+            return result;
+        }
+
+        TEXGEN_INLINE friend packet operator- (const packet &p1, const packet &p2) {
+            packet result;
+            for (int i=0; i<N; i++) result.lanes[i] = p1.lanes[i] - p2.lanes[i];
+            return result;
+        }
+
+        TEXGEN_INLINE friend packet operator* (const packet &p1, const packet &p2) {
+            packet result;
+            for (int i=0; i<N; i++) result.lanes[i] = p1.lanes[i] * p2.lanes[i];
+            return result;
+        }
+
+        TEXGEN_INLINE friend packet operator/ (const packet &p1, const packet &p2) {
+            packet result;
+            for (int i=0; i<N; i++) result.lanes[i] = p1.lanes[i] / p2.lanes[i];
+            return result;
+        }
+
+        TEXGEN_INLINE packet& operator+= (const packet &p) { return *this = *this + p; }
+        TEXGEN_INLINE packet& operator-= (const packet &p) { return *this = *this - p; }
+        TEXGEN_INLINE packet& operator*= (const packet &p) { return *this = *this * p; }
+        TEXGEN_INLINE packet& operator/= (const packet &p) { return *this = *this / p; }
+
+        TEXGEN_INLINE friend mask<T, N> operator< (const packet &p1, const packet &p2) {
+            mask<T, N> result;
+            for (int i=0; i<N; i++) result.lanes[i] = -static_cast<typename mask<T, N>::integer>(p1.lanes[i] < p2.lanes[i]);
+            return result;
+        }
+
+        TEXGEN_INLINE friend mask<T, N> operator> (const packet &p1, const packet &p2) {
+            return p2 < p1;
+        }
+
+        TEXGEN_INLINE friend mask<T, N> operator<= (const packet &p1, const packet &p2) {
+            mask<T, N> result;
+            for (int i=0; i<N; i++) result.lanes[i] = -static_cast<typename mask<T, N>::integer>(p1.lanes[i] <= p2.lanes[i]);
+            return result;
+        }
+
+        TEXGEN_INLINE friend mask<T, N> operator>= (const packet &p1, const packet &p2) {
+            return p2 <= p1;
+        }
+    };
+
+    typedef packet<float, 4> float4;
+    typedef packet<float, 8> float8;
+    typedef packet<float, 16> float16;
+
+    // branchless selection: lanes where the condition holds take 'a', the rest take 'b'
+    template<typename T>
+    TEXGEN_INLINE constexpr T select(const bool c, const T a, const T b) {
+        return c ? a : b;
+    }
+
+    // blends the bits instead of using ?: per lane. once the lane loops are unrolled a
+    // ?: turns into branches, while the bitwise form still maps to a vector blend.
+    template<typename T, int N>
+    TEXGEN_INLINE packet<T, N> select(const mask<T, N> &c, const packet<T, N> &a, const packet<T, N> &b) {
+        typedef typename mask<T, N>::integer integer;
+
+        packet<T, N> result;
+
+        for (int i=0; i<N; i++) {
+            integer x, y;
+
+            std::memcpy(&x, &a.lanes[i], sizeof(T));
+            std::memcpy(&y, &b.lanes[i], sizeof(T));
+
+            const integer z = (x & c.lanes[i]) | (y & ~c.lanes[i]);
+
+            std::memcpy(&result.lanes[i], &z, sizeof(T));
+        }
+
+        return result;
+    }
+
+    // std::trunc isn't constexpr, so scalars take the integer conversion path of the
+    // packets below. unlike std::trunc, values in (-1, 0) truncate to +0.
+    template<typename T>
+    TEXGEN_INLINE constexpr T trunc(const T x) {
+        return (x < T(0) ? -x : x) < T(1) / std::numeric_limits<T>::epsilon() ? static_cast<T>(static_cast<typename lane_integer<T>::type>(x)) : x;
+    }
+
+    template<typename T>
+    TEXGEN_INLINE constexpr T step(const T a, const T x) {
+        return select(x >= a, T(1), T(0));
+    }
+
+    template<typename T>
+    TEXGEN_INLINE constexpr T pulse(const T a, const T b, const T x) {
+        return step(a, x) - step(b, x);
+    }
+
+    template<typename T>
+    TEXGEN_INLINE constexpr T min(const T a, const T b) {
+        return select(a < b, a, b);
+    }
+
+    template<typename T>
+    TEXGEN_INLINE constexpr T max(const T a, const T b) {
+        return select(a < b, b, a);
+    }
+
+    template<typename T>
+    TEXGEN_INLINE constexpr T clamp(const T x, const T a, const T b) {
+        return min(max(x, a), b);
+    }
+
+    template<typename T>
+    TEXGEN_INLINE constexpr T abs(const T x) {
+        return select(x < T(0), -x, x);
+    }
+
+    template<typename T>
+    TEXGEN_INLINE constexpr T smoothstep(const T a, const T b, const T x) {
+        const T x_ = clamp((x - a) / (b - a), T(0), T(1));
+
+        return x_*x_ * (T(3) - T(2)*x_);
+    }
+
+    template<typename T>
+    TEXGEN_INLINE constexpr T mix(const T a, const T b, const T t) {
+        return a + t*(b - a);
+    }
+
+    template<typename T>
+    TEXGEN_INLINE constexpr T mod(const T a, const T b) {
+        const T result = a - b*trunc(a / b);
+
+        return result + select(result < T(0), b, T(0));
+    }
+
+    template<typename T>
+    TEXGEN_INLINE T cos(const T x) {
+        return std::cos(x);
+    }
+
+    template<typename T>
+    TEXGEN_INLINE T sin(const T x) {
+        return std::sin(x);
+    }
+    
+    // compilers don't vectorize a loop of std::trunc, but they do vectorize integer
+    // conversions. lanes at or beyond 1/epsilon are integral already and pass through;
+    // the rest are clamped first, so the conversion never overflows.
+    template<typename T, int N>
+    TEXGEN_INLINE packet<T, N> trunc(const packet<T, N> &x) {
+        typedef typename lane_integer<T>::type integer;
+
+        const packet<T, N> limit(T(1) / std::numeric_limits<T>::epsilon());
+        const packet<T, N> clamped = clamp(x, -limit, limit);
+
+        packet<T, N> result;
+        for (int i=0; i<N; i++) result.lanes[i] = static_cast<T>(static_cast<integer>(clamped.lanes[i]));
+
+        return select(abs(x) < limit, result, x);
+    }
+
+    template<typename T>
+    TEXGEN_INLINE constexpr T floor(const T x) {
+        return trunc(x) - (trunc(x) > x ? T(1) : T(0));
+    }
+
+    template<typename T, int N>
+    TEXGEN_INLINE packet<T, N> floor(const packet<T, N> &x) {
+        const packet<T, N> t = trunc(x);
+
+        return t - select(t > x, packet<T, N>(1), packet<T, N>(0));
+    }
+
+    // accuracy tiers for the polynomial transcendentals. maximum errors, measured in
+    // float against the double precision library over |x| < 8192:
+    //  fast: 3.5e-5 absolute (degree 5 sine and degree 4 cosine minimax polynomials)
+    //  precise: 9.3e-8 absolute, 1.5 ulp (degree 7 sine and degree 8 cosine, from cephes)
+    // for larger arguments the range reduction loses precision. with T = double both
+    // tiers keep their float error bounds.
+    enum accuracy {
+        fast,
+        precise
+    };
+
+    template<accuracy A>
+    struct trig_kernel;
+
+    // sine and cosine over the reduced range [-pi/4, pi/4]
+    template<>
+    struct trig_kernel<fast> {
+        template<typename T>
+        TEXGEN_INLINE static constexpr T sin(const T r) {
+            const T z = r*r;
+
+            return r + r*z*(T(-0.16662833806931357) + z*T(0.008152992341807538));
+        }
+
+        template<typename T>
+        TEXGEN_INLINE static constexpr T cos(const T r) {
+            const T z = r*r;
+
+            return T(1) - T(0.5)*z + z*z*T(0.04090844365621555);
+        }
+    };
+
+    template<>
+    struct trig_kernel<precise> {
+        template<typename T>
+        TEXGEN_INLINE static constexpr T sin(const T r) {
+            const T z = r*r;
+
+            return r + r*z*(T(-1.6666654611e-1) + z*(T(8.3321608736e-3) + z*T(-1.9515295891e-4)));
+        }
+
+        template<typename T>
+        TEXGEN_INLINE static constexpr T cos(const T r) {
+            const T z = r*r;
+
+            return T(1) - T(0.5)*z + z*z*(T(4.166664568298827e-2) + z*(T(-1.388731625493765e-3) + z*T(2.443315711809948e-5)));
+        }
+    };
+
+    // reduces x to r in [-pi/4, pi/4] and the quadrant k, with x = k*pi/2 + r, then
+    // picks the kernel and sign by quadrant without branching. 'shift' adds quadrants,
+    // so the cosine is the sine shifted by one.
+    template<accuracy A, typename T>
+    TEXGEN_INLINE constexpr T sincos(const T x, const T shift) {
+        const T k = floor(x*T(0.63661977236758134) + T(0.5));
+
+        // pi/2 split in three parts, so the first products are exact (Cody-Waite)
+        const T r = ((x - k*T(1.5703125)) - k*T(4.837512969970703125e-4)) - k*T(7.54978995489188216e-8);
+
+        const T q = k + shift;
+        const T half = floor(q*T(0.5));
+        const T odd = q - T(2)*half;
+        const T negative = half - T(2)*floor(half*T(0.5));
+
+        const T s = trig_kernel<A>::sin(r);
+        const T c = trig_kernel<A>::cos(r);
+
+        const T value = select(odd > T(0.5), c, s);
+
+        return select(negative > T(0.5), -value, value);
+    }
+
+    template<accuracy A, typename T>
+    TEXGEN_INLINE constexpr T sin(const T x) {
+        return sincos<A>(x, T(0));
+    }
+
+    template<accuracy A, typename T>
+    TEXGEN_INLINE constexpr T cos(const T x) {
+        return sincos<A>(x, T(1));
+    }
+
+    // packets have no library sin and cos to fall back on, so they use the precise tier
+    template<typename T, int N>
+    TEXGEN_INLINE packet<T, N> sin(const packet<T, N> &x) {
+        return sin<precise>(x);
+    }
+
+    template<typename T, int N>
+    TEXGEN_INLINE packet<T, N> cos(const packet<T, N> &x) {
+        return cos<precise>(x);
+    }
+
+    // box-filtered (antialiased) versions of step, pulse, pulse train and mod: each one
+    // returns the average of the unfiltered function over [x - w/2, x + w/2], so 'w' is
+    // the filter width, typically the pixel footprint in the units of x. the width is
+    // kept away from zero, where the results tend to the unfiltered functions.
+    template<typename T>
+    TEXGEN_INLINE constexpr T filterwidth(const T w) {
+        return max(w, T(1e-6));
+    }
+
+    template<typename T>
+    TEXGEN_INLINE constexpr T filteredstep(const T edge, const T x, const T w) {
+        return clamp((x - edge) / filterwidth(w) + T(0.5), T(0), T(1));
+    }
+
+    template<typename T>
+    TEXGEN_INLINE constexpr T filteredpulse(const T edge0, const T edge1, const T x, const T w) {
+        const T fw = filterwidth(w);
+        const T x0 = x - T(0.5)*fw;
+        const T x1 = x0 + fw;
+
+        return max(T(0), (min(x1, edge1) - max(x0, edge0)) / fw);
+    }
+
+    // pulse train: 0 over the first 'edge' units of every period, 1 over the rest, i.e.
+    // step(edge, mod(x, period)). filtered through the closed form of its integral.
+    template<typename T>
+    TEXGEN_INLINE constexpr T pulsetrain_integral(const T edge, const T x) {
+        const T i = floor(x);
+
+        return (T(1) - edge)*i + max(T(0), x - i - edge);
+    }
+
+    template<typename T>
+    TEXGEN_INLINE constexpr T filteredpulsetrain(const T edge, const T period, const T x, const T w) {
+        const T fw = filterwidth(w) / period;
+        const T x0 = x / period - T(0.5)*fw;
+        const T x1 = x0 + fw;
+        const T e = edge / period;
+
+        return (pulsetrain_integral(e, x1) - pulsetrain_integral(e, x0)) / fw;
+    }
+
+    // mod(x, b) integrates to b*b/2 per whole period plus mod(x, b)^2 / 2
+    template<typename T>
+    TEXGEN_INLINE constexpr T mod_integral(const T x, const T b) {
+        const T m = mod(x, b);
+
+        return T(0.5)*(floor(x / b)*b*b + m*m);
+    }
+
+    template<typename T>
+    TEXGEN_INLINE constexpr T filteredmod(const T a, const T b, const T w) {
+        const T fw = filterwidth(w);
+        const T a0 = a - T(0.5)*fw;
+
+        return (mod_integral(a0 + fw, b) - mod_integral(a0, b)) / fw;
+    }
+
+    template<typename T>
+    constexpr T spline(const T x, const int nknots, const T *knot) {
+        assert(nknots > 3);
+
+        const T cr00 = -0.5; const T cr01 = 1.5; const T cr02 = -1.5; const T cr03 = 0.5; 
+        const T cr10 = 1.0; const T cr11 = -2.5; const T cr12 = 2.0; const T cr13 = -0.5;
+        const T cr20 = -0.5; const T cr21 = 0.0; const T cr22 = 0.5; const T cr23 = 0.0;
+        const T cr30 = 0.0; const T cr31 = 1.0; const T cr32 = 0.0; const T cr33 = 0.0;
+
+        const int nspans = nknots - 3;
+
+        T xx = clamp(x, T(0), T(1)) * nspans;
+
+        int span = static_cast<int>(xx);
+
+        if (span >= nspans) {
+            span = nspans - 1;
+        }
+
+        xx -= span;
+        knot += span;
+
+        const T c3 = cr00*knot[0] + cr01*knot[1] + cr02*knot[2] + cr03*knot[3];
+        const T c2 = cr10*knot[0] + cr11*knot[1] + cr12*knot[2] + cr13*knot[3];
+        const T c1 = cr20*knot[0] + cr21*knot[1] + cr22*knot[2] + cr23*knot[3];
+        const T c0 = cr30*knot[0] + cr31*knot[1] + cr32*knot[2] + cr33*knot[3];
+
+        return ((c3*xx + c2)*xx + c1)*xx + c0;
+    }
+
+    // fixed size table of samples, filled by make_table
+    template<typename T, std::size_t N>
+    struct table {
+        T values[N];
+
+        constexpr T operator[] (const std::size_t i) const {
+            return values[i];
+        }
+
+        static constexpr std::size_t size() {
+            return N;
+        }
+
+        // linear interpolation between the samples, for x in [0, 1]
+        constexpr T lookup(const T x) const {
+            const T xx = clamp(x, T(0), T(1)) * T(N - 1);
+            const std::size_t i = texgen::min(static_cast<std::size_t>(xx), N - 2);
+
+            return mix(values[i], values[i + 1], xx - T(i));
+        }
+    };
+
+    // samples f at N evenly spaced points over [from, to], both ends included. with a
+    // constexpr f and a constexpr destination, the table is built by the compiler and
+    // lands in read-only data:
+    //  constexpr auto ramp = texgen::make_table<float, 256>(function_object());
+    template<typename T, std::size_t N, typename Function>
+    constexpr table<T, N> make_table(const Function &f, const T from = T(0), const T to = T(1)) {
+        static_assert(N > 1, "a table needs at least two samples");
+
+        table<T, N> result = {};
+
+        for (std::size_t i=0; i<N; i++) {
+            result.values[i] = f(from + (to - from) * T(i) / T(N - 1));
+        }
+
+        return result;
+    }
+
+    // Catmull-Rom spline with the per-span polynomial coefficients computed once, for
+    // ramps that get evaluated many times with the same knots. the coefficients are
+    // stored by degree, so a batch of lookups gathers from four contiguous arrays.
+    template<typename T>
+    class spline_curve {
+    public:
+        spline_curve(const int nknots, const T *knot) : m_nspans(nknots - 3) {
+            assert(nknots > 3);
+
+            m_c3.resize(m_nspans);
+            m_c2.resize(m_nspans);
+            m_c1.resize(m_nspans);
+            m_c0.resize(m_nspans);
+
+            for (int span=0; span<m_nspans; span++) {
+                const T *k = knot + span;
+
+                m_c3[span] = T(-0.5)*k[0] + T(1.5)*k[1] + T(-1.5)*k[2] + T(0.5)*k[3];
+                m_c2[span] = T(1.0)*k[0] + T(-2.5)*k[1] + T(2.0)*k[2] + T(-0.5)*k[3];
+                m_c1[span] = T(-0.5)*k[0] + T(0.5)*k[2];
+                m_c0[span] = k[1];
+            }
+        }
+
+        int spans() const {
+            return m_nspans;
+        }
+
+        T operator() (const T x) const {
+            T xx = clamp(x, T(0), T(1)) * m_nspans;
+
+            const int span = texgen::min(static_cast<int>(xx), m_nspans - 1);
+
+            xx -= span;
+
+            return ((m_c3[span]*xx + m_c2[span])*xx + m_c1[span])*xx + m_c0[span];
+        }
+
+        template<int N>
+        packet<T, N> operator() (const packet<T, N> &x) const {
+            packet<T, N> result;
+
+            // untraced, a packet is far too small a unit of work for an event
+            evaluate_span(x.lanes, result.lanes, N);
+
+            return result;
+        }
+
+        // evaluates the spline over 'count' inputs
+        void evaluate(const T *x, T *result, const std::size_t count) const {
+            TRACE_SCOPE("spline_curve::evaluate");
+
+            evaluate_span(x, result, count);
+        }
+
+    private:
+        // the loop has no branches, so it vectorizes down to the span gathers. the input
+        // is scaled before clamping: clamping first lets the compiler thread the x == 1
+        // case into a branch.
+        void evaluate_span(const T *x, T *result, const std::size_t count) const {
+            const T nspans = static_cast<T>(m_nspans);
+            const T last = static_cast<T>(m_nspans - 1);
+
+            const T *c3 = m_c3.data();
+            const T *c2 = m_c2.data();
+            const T *c1 = m_c1.data();
+            const T *c0 = m_c0.data();
+
+            for (std::size_t i=0; i<count; i++) {
+                T xx = clamp(x[i] * nspans, T(0), nspans);
+
+                const int span = static_cast<int>(texgen::min(xx, last));
+
+                xx -= static_cast<T>(span);
+
+                result[i] = ((c3[span]*xx + c2[span])*xx + c1[span])*xx + c0[span];
+            }
+        }
+
+        int m_nspans;
+        std::vector<T> m_c3, m_c2, m_c1, m_c0;
+    };
+
+    // gradient noise (Perlin), in 2, 3 and 4 dimensions. the lattice is hashed through a
+    // 512 byte permutation table shuffled from the seed, and the gradients are taken from
+    // small constant tables, so the whole working set stays in L1. the result lies
+    // roughly in [-1, 1].
+    class gradient_noise {
+    public:
+        explicit gradient_noise(const unsigned seed = 0) {
+            for (int i=0; i<256; i++) {
+                m_perm[i] = static_cast<unsigned char>(i);
+            }
+
+            // Fisher-Yates shuffle driven by an explicit LCG, so a seed gives the same
+            // table on every platform and standard library
+            unsigned state = seed;
+
+            for (int i=255; i>0; i--) {
+                state = state*1664525u + 1013904223u;
+
+                const int j = static_cast<int>((state >> 8) % static_cast<unsigned>(i + 1));
+                const unsigned char tmp = m_perm[i];
+
+                m_perm[i] = m_perm[j];
+                m_perm[j] = tmp;
+            }
+
+            for (int i=0; i<256; i++) {
+                m_perm[256 + i] = m_perm[i];
+            }
+        }
+
+        template<typename T>
+        T operator() (const T x, const T y) const {
+            const T i = floor(x), j = floor(y);
+            const T fx = x - i, fy = y - j;
+            const T u = fade(fx), v = fade(fy);
+
+            const T n00 = corner(i, j, fx, fy);
+            const T n10 = corner(i + T(1), j, fx - T(1), fy);
+            const T n01 = corner(i, j + T(1), fx, fy - T(1));
+            const T n11 = corner(i + T(1), j + T(1), fx - T(1), fy - T(1));
+
+            return mix(mix(n00, n10, u), mix(n01, n11, u), v);
+        }
+
+        template<typename T>
+        T operator() (const T x, const T y, const T z) const {
+            const T i = floor(x), j = floor(y), k = floor(z);
+            const T fx = x - i, fy = y - j, fz = z - k;
+            const T u = fade(fx), v = fade(fy), w = fade(fz);
+
+            const T i1 = i + T(1), j1 = j + T(1), k1 = k + T(1);
+            const T gx = fx - T(1), gy = fy - T(1), gz = fz - T(1);
+
+            const T n000 = corner(i, j, k, fx, fy, fz);
+            const T n100 = corner(i1, j, k, gx, fy, fz);
+            const T n010 = corner(i, j1, k, fx, gy, fz);
+            const T n110 = corner(i1, j1, k, gx, gy, fz);
+            const T n001 = corner(i, j, k1, fx, fy, gz);
+            const T n101 = corner(i1, j, k1, gx, fy, gz);
+            const T n011 = corner(i, j1, k1, fx, gy, gz);
+            const T n111 = corner(i1, j1, k1, gx, gy, gz);
+
+            return mix(
+                mix(mix(n000, n100, u), mix(n010, n110, u), v),
+                mix(mix(n001, n101, u), mix(n011, n111, u), v),
+                w
+            );
+        }
+
+        template<typename T>
+        T operator() (const T x, const T y, const T z, const T w) const {
+            const T i = floor(x), j = floor(y), k = floor(z), l = floor(w);
+            const T fx = x - i, fy = y - j, fz = z - k, fw = w - l;
+            const T u = fade(fx), v = fade(fy), s = fade(fz), t = fade(fw);
+
+            T n[2][2][2][2];
+
+            for (int dl=0; dl<2; dl++) {
+                for (int dk=0; dk<2; dk++) {
+                    for (int dj=0; dj<2; dj++) {
+                        for (int di=0; di<2; di++) {
+                            n[dl][dk][dj][di] = corner(
+                                i + T(di), j + T(dj), k + T(dk), l + T(dl),
+                                fx - T(di), fy - T(dj), fz - T(dk), fw - T(dl)
+                            );
+                        }
+                    }
+                }
+            }
+
+            T nw[2];
+
+            for (int dl=0; dl<2; dl++) {
+                nw[dl] = mix(
+                    mix(mix(n[dl][0][0][0], n[dl][0][0][1], u), mix(n[dl][0][1][0], n[dl][0][1][1], u), v),
+                    mix(mix(n[dl][1][0][0], n[dl][1][0][1], u), mix(n[dl][1][1][0], n[dl][1][1][1], u), v),
+                    s
+                );
+            }
+
+            return mix(nw[0], nw[1], t);
+        }
+
+        // fractional brownian motion: sum of octaves, each one scaled in frequency by
+        // 'lacunarity' and in amplitude by 'gain'
+        template<typename T>
+        T fbm(const T x, const T y, const int octaves, const T lacunarity = T(2), const T gain = T(0.5)) const {
+            T sum = T(0), amplitude = T(1), frequency = T(1);
+
+            for (int octave=0; octave<octaves; octave++) {
+                sum += amplitude * (*this)(x*frequency, y*frequency);
+                frequency *= lacunarity;
+                amplitude *= gain;
+            }
+
+            return sum;
+        }
+
+        template<typename T>
+        T fbm(const T x, const T y, const T z, const int octaves, const T lacunarity = T(2), const T gain = T(0.5)) const {
+            T sum = T(0), amplitude = T(1), frequency = T(1);
+
+            for (int octave=0; octave<octaves; octave++) {
+                sum += amplitude * (*this)(x*frequency, y*frequency, z*frequency);
+                frequency *= lacunarity;
+                amplitude *= gain;
+            }
+
+            return sum;
+        }
+
+        template<typename T>
+        T fbm(const T x, const T y, const T z, const T w, const int octaves, const T lacunarity = T(2), const T gain = T(0.5)) const {
+            T sum = T(0), amplitude = T(1), frequency = T(1);
+
+            for (int octave=0; octave<octaves; octave++) {
+                sum += amplitude * (*this)(x*frequency, y*frequency, z*frequency, w*frequency);
+                frequency *= lacunarity;
+                amplitude *= gain;
+            }
+
+            return sum;
+        }
+
+        // like fbm, but summing the absolute value of each octave
+        template<typename T>
+        T turbulence(const T x, const T y, const int octaves, const T lacunarity = T(2), const T gain = T(0.5)) const {
+            T sum = T(0), amplitude = T(1), frequency = T(1);
+
+            for (int octave=0; octave<octaves; octave++) {
+                sum += amplitude * abs((*this)(x*frequency, y*frequency));
+                frequency *= lacunarity;
+                amplitude *= gain;
+            }
+
+            return sum;
+        }
+
+        template<typename T>
+        T turbulence(const T x, const T y, const T z, const int octaves, const T lacunarity = T(2), const T gain = T(0.5)) const {
+            T sum = T(0), amplitude = T(1), frequency = T(1);
+
+            for (int octave=0; octave<octaves; octave++) {
+                sum += amplitude * abs((*this)(x*frequency, y*frequency, z*frequency));
+                frequency *= lacunarity;
+                amplitude *= gain;
+            }
+
+            return sum;
+        }
+
+        template<typename T>
+        T turbulence(const T x, const T y, const T z, const T w, const int octaves, const T lacunarity = T(2), const T gain = T(0.5)) const {
+            T sum = T(0), amplitude = T(1), frequency = T(1);
+
+            for (int octave=0; octave<octaves; octave++) {
+                sum += amplitude * abs((*this)(x*frequency, y*frequency, z*frequency, w*frequency));
+                frequency *= lacunarity;
+                amplitude *= gain;
+            }
+
+            return sum;
+        }
+
+    private:
+        template<typename T>
+        static T fade(const T t) {
+            return t*t*t*(t*(t*T(6) - T(15)) + T(10));
+        }
+
+        template<typename T>
+        static int wrap(const T i) {
+            return static_cast<int>(i) & 255;
+        }
+
+        template<typename T>
+        int hash(const T i, const T j) const {
+            return m_perm[m_perm[wrap(i)] + wrap(j)];
+        }
+
+        template<typename T>
+        int hash(const T i, const T j, const T k) const {
+            return m_perm[hash(i, j) + wrap(k)];
+        }
+
+        template<typename T>
+        int hash(const T i, const T j, const T k, const T l) const {
+            return m_perm[hash(i, j, k) + wrap(l)];
+        }
+
+        template<typename T>
+        static const T* gradient2(const int h) {
+            static const T grad[8][2] = {
+                {1, 1}, {-1, 1}, {1, -1}, {-1, -1},
+                {1, 0}, {-1, 0}, {0, 1}, {0, -1}
+            };
+
+            return grad[h & 7];
+        }
+
+        template<typename T>
+        static const T* gradient3(const int h) {
+            static const T grad[16][3] = {
+                {1, 1, 0}, {-1, 1, 0}, {1, -1, 0}, {-1, -1, 0},
+                {1, 0, 1}, {-1, 0, 1}, {1, 0, -1}, {-1, 0, -1},
+                {0, 1, 1}, {0, -1, 1}, {0, 1, -1}, {0, -1, -1},
+                {1, 1, 0}, {-1, 1, 0}, {0, -1, 1}, {0, -1, -1}
+            };
+
+            return grad[h & 15];
+        }
+
+        template<typename T>
+        static const T* gradient4(const int h) {
+            // the 32 edge midpoints of the 4-cube
+            static const T grad[32][4] = {
+                {0, 1, 1, 1}, {0, 1, 1, -1}, {0, 1, -1, 1}, {0, 1, -1, -1},
+                {0, -1, 1, 1}, {0, -1, 1, -1}, {0, -1, -1, 1}, {0, -1, -1, -1},
+                {1, 0, 1, 1}, {1, 0, 1, -1}, {1, 0, -1, 1}, {1, 0, -1, -1},
+                {-1, 0, 1, 1}, {-1, 0, 1, -1}, {-1, 0, -1, 1}, {-1, 0, -1, -1},
+                {1, 1, 0, 1}, {1, 1, 0, -1}, {1, -1, 0, 1}, {1, -1, 0, -1},
+                {-1, 1, 0, 1}, {-1, 1, 0, -1}, {-1, -1, 0, 1}, {-1, -1, 0, -1},
+                {1, 1, 1, 0}, {1, 1, -1, 0}, {1, -1, 1, 0}, {1, -1, -1, 0},
+                {-1, 1, 1, 0}, {-1, 1, -1, 0}, {-1, -1, 1, 0}, {-1, -1, -1, 0}
+            };
+
+            return grad[h & 31];
+        }
+
+        // gradient contribution of a single lattice corner. the lattice coordinates
+        // come in as floored values. packets hash and gather their gradients lane by
+        // lane, and do the dot product in packet arithmetic.
+        template<typename T>
+        T corner(const T i, const T j, const T x, const T y) const {
+            const T *g = gradient2<T>(hash(i, j));
+
+            return g[0]*x + g[1]*y;
+        }
+
+        template<typename T>
+        T corner(const T i, const T j, const T k, const T x, const T y, const T z) const {
+            const T *g = gradient3<T>(hash(i, j, k));
+
+            return g[0]*x + g[1]*y + g[2]*z;
+        }
+
+        template<typename T>
+        T corner(const T i, const T j, const T k, const T l, const T x, const T y, const T z, const T w) const {
+            const T *g = gradient4<T>(hash(i, j, k, l));
+
+            return g[0]*x + g[1]*y + g[2]*z + g[3]*w;
+        }
+
+        template<typename T, int N>
+        packet<T, N> corner(const packet<T, N> &i, const packet<T, N> &j, const packet<T, N> &x, const packet<T, N> &y) const {
+            packet<T, N> gx, gy;
+
+            for (int n=0; n<N; n++) {
+                const T *g = gradient2<T>(hash(i[n], j[n]));
+                gx[n] = g[0]; gy[n] = g[1];
+            }
+
+            return gx*x + gy*y;
+        }
+
+        template<typename T, int N>
+        packet<T, N> corner(const packet<T, N> &i, const packet<T, N> &j, const packet<T, N> &k, const packet<T, N> &x, const packet<T, N> &y, const packet<T, N> &z) const {
+            packet<T, N> gx, gy, gz;
+
+            for (int n=0; n<N; n++) {
+                const T *g = gradient3<T>(hash(i[n], j[n], k[n]));
+                gx[n] = g[0]; gy[n] = g[1]; gz[n] = g[2];
+            }
+
+            return gx*x + gy*y + gz*z;
+        }
+
+        template<typename T, int N>
+        packet<T, N> corner(const packet<T, N> &i, const packet<T, N> &j, const packet<T, N> &k, const packet<T, N> &l, const packet<T, N> &x, const packet<T, N> &y, const packet<T, N> &z, const packet<T, N> &w) const {
+            packet<T, N> gx, gy, gz, gw;
+
+            for (int n=0; n<N; n++) {
+                const T *g = gradient4<T>(hash(i[n], j[n], k[n], l[n]));
+                gx[n] = g[0]; gy[n] = g[1]; gz[n] = g[2]; gw[n] = g[3];
+            }
+
+            return gx*x + gy*y + gz*z + gw*w;
+        }
+
+        unsigned char m_perm[512];
+    };
+
+    // virtual texture over a procedural shader. the texture is split in square tiles at
+    // every mip level, and a tile is baked by evaluating the shader at its texel centers
+    // the first time it gets sampled. baked tiles live in a fixed number of slots,
+    // bounded by the memory budget, organised as a set associative cache: a tile maps to
+    // one set of 'ways' slots, and a miss replaces the least recently used slot of that set.
+    //
+    // hits are lock-free: a reader pins the slot with an atomic counter, checks the key,
+    // and reads the texel. misses take the lock of their set, so bakes of different sets
+    // proceed in parallel.
+    template<typename Shader>
+    class tile_cache {
+    public:
+        struct statistics {
+            std::uint64_t hits;
+            std::uint64_t misses;
+            std::uint64_t evictions;
+            std::size_t resident_tiles;
+            std::size_t capacity_tiles;
+            // the memory of the slots, which is the budget rounded down to whole sets
+            std::size_t capacity_bytes;
+            std::size_t budget_bytes;
+        };
+
+        static const int ways = 8;
+
+        // 'size' is the resolution of level 0 and 'tile_size' the tile side, both powers
+        // of two. the pyramid stops at the level that fits in a single tile. the budget
+        // must hold at least one set of 'ways' tiles.
+        tile_cache(Shader shader, const int size, const int tile_size, const std::size_t budget_bytes)
+            : m_shader(shader), m_size(size), m_tile_size(tile_size), m_levels(1), m_clock(0),
+              m_hits(0), m_misses(0), m_evictions(0) {
+
+            assert(size >= tile_size && tile_size > 0);
+            assert((size & (size - 1)) == 0 && (tile_size & (tile_size - 1)) == 0);
+
+            while ((m_size >> m_levels) >= m_tile_size) {
+                m_levels++;
+            }
+
+            const std::size_t tile_bytes = sizeof(float) * tile_size * tile_size;
+
+            if (budget_bytes < tile_bytes * ways) {
+                throw std::invalid_argument("texgen: the tile cache budget can't hold a set of tiles");
+            }
+
+            m_sets = budget_bytes / (tile_bytes * ways);
+            m_budget_bytes = budget_bytes;
+            m_slots.reset(new slot[m_sets * ways]);
+            m_locks.reset(new std::mutex[m_sets]);
+        }
+
+        int levels() const {
+            return m_levels;
+        }
+
+        // nearest texel of the given mip level, with u and v clamped to [0, 1]
+        float sample(const float u, const float v, const int level) {
+            assert(level >= 0 && level < m_levels);
+
+            const int size = m_size >> level;
+            const int x = texgen::clamp(static_cast<int>(u * size), 0, size - 1);
+            const int y = texgen::clamp(static_cast<int>(v * size), 0, size - 1);
+
+            const int tx = x / m_tile_size, ty = y / m_tile_size;
+            const int offset = (y % m_tile_size) * m_tile_size + (x % m_tile_size);
+
+            const std::uint64_t key = make_key(level, tx, ty);
+            const std::size_t set = hash(key) % m_sets;
+
+            float value;
+
+            if (this->lookup(set, key, offset, value)) {
+                m_hits.fetch_add(1, std::memory_order_relaxed);
+                return value;
+            }
+
+            std::lock_guard<std::mutex> lock(m_locks[set]);
+
+            // another thread may have baked it while we were waiting for the lock
+            if (this->lookup(set, key, offset, value)) {
+                m_hits.fetch_add(1, std::memory_order_relaxed);
+                return value;
+            }
+
+            m_misses.fetch_add(1, std::memory_order_relaxed);
+
+            slot &victim = this->evict(set);
+
+            this->bake(victim, level, tx, ty);
+            value = victim.texels[offset];
+
+            victim.stamp.store(m_clock.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+            victim.key.store(key, std::memory_order_release);
+            victim.pins.fetch_sub(evicting, std::memory_order_acq_rel);
+
+            return value;
+        }
+
+        statistics stats() const {
+            statistics result;
+
+            result.hits = m_hits.load(std::memory_order_relaxed);
+            result.misses = m_misses.load(std::memory_order_relaxed);
+            result.evictions = m_evictions.load(std::memory_order_relaxed);
+            result.resident_tiles = 0;
+            result.capacity_tiles = m_sets * ways;
+            result.capacity_bytes = result.capacity_tiles * sizeof(float) * m_tile_size * m_tile_size;
+            result.budget_bytes = m_budget_bytes;
+
+            for (std::size_t i=0; i<m_sets * ways; i++) {
+                if (m_slots[i].key.load(std::memory_order_relaxed) != invalid_key) {
+                    result.resident_tiles++;
+                }
+            }
+
+            return result;
+        }
+
+    private:
+        static const std::uint64_t invalid_key = ~std::uint64_t(0);
+
+        // added to the pin count while a slot is being rebaked, so readers see it negative
+        static const int evicting = -(1 << 30);
+
+        struct slot {
+            slot() : key(invalid_key), pins(0), stamp(0) {}
+
+            std::atomic<std::uint64_t> key;
+            std::atomic<int> pins;
+            std::atomic<std::uint64_t> stamp;
+            std::vector<float> texels;
+        };
+
+        static std::uint64_t make_key(const int level, const int tx, const int ty) {
+            return (std::uint64_t(level) << 58) | (std::uint64_t(ty) << 29) | std::uint64_t(tx);
+        }
+
+        static std::size_t hash(std::uint64_t key) {
+            key ^= key >> 33;
+            key *= 0xff51afd7ed558ccdull;
+            key ^= key >> 33;
+
+            return static_cast<std::size_t>(key);
+        }
+
+        bool lookup(const std::size_t set, const std::uint64_t key, const int offset, float &value) {
+            slot *slots = &m_slots[set * ways];
+
+            for (int way=0; way<ways; way++) {
+                slot &s = slots[way];
+
+                if (s.key.load(std::memory_order_acquire) != key) {
+                    continue;
+                }
+
+                const bool pinned = s.pins.fetch_add(1, std::memory_order_acq_rel) >= 0;
+
+                if (pinned && s.key.load(std::memory_order_acquire) == key) {
+                    value = s.texels[offset];
+                    s.stamp.store(m_clock.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                    s.pins.fetch_sub(1, std::memory_order_acq_rel);
+
+                    return true;
+                }
+
+                s.pins.fetch_sub(1, std::memory_order_acq_rel);
+            }
+
+            return false;
+        }
+
+        // picks the least recently used slot of the set and takes it away from readers.
+        // called with the set locked.
+        slot& evict(const std::size_t set) {
+            slot *slots = &m_slots[set * ways];
+
+            for (;;) {
+                int victim = -1;
+
+                for (int way=0; way<ways; way++) {
+                    if (slots[way].pins.load(std::memory_order_relaxed) != 0) {
+                        continue;
+                    }
+
+                    if (victim < 0 || slots[way].stamp.load(std::memory_order_relaxed) < slots[victim].stamp.load(std::memory_order_relaxed)) {
+                        victim = way;
+                    }
+                }
+
+                int expected = 0;
+
+                if (victim >= 0 && slots[victim].pins.compare_exchange_strong(expected, evicting, std::memory_order_acq_rel)) {
+                    slot &s = slots[victim];
+
+                    if (s.key.load(std::memory_order_relaxed) != invalid_key) {
+                        m_evictions.fetch_add(1, std::memory_order_relaxed);
+                    }
+
+                    s.key.store(invalid_key, std::memory_order_relaxed);
+
+                    return s;
+                }
+
+                // every slot is pinned for a moment by a reader
+                std::this_thread::yield();
+            }
+        }
+
+        void bake(slot &s, const int level, const int tx, const int ty) {
+            TRACE_SCOPE("tile_cache::bake");
+
+            const float size = static_cast<float>(m_size >> level);
+
+            s.texels.resize(m_tile_size * m_tile_size);
+
+            for (int j=0; j<m_tile_size; j++) {
+                const float v = (ty*m_tile_size + j + 0.5f) / size;
+
+                for (int i=0; i<m_tile_size; i++) {
+                    const float u = (tx*m_tile_size + i + 0.5f) / size;
+
+                    s.texels[j*m_tile_size + i] = m_shader(u, v);
+                }
+            }
+        }
+
+    private:
+        Shader m_shader;
+        int m_size;
+        int m_tile_size;
+        int m_levels;
+        std::size_t m_sets;
+        std::size_t m_budget_bytes;
+        std::unique_ptr<slot[]> m_slots;
+        std::unique_ptr<std::mutex[]> m_locks;
+        std::atomic<std::uint64_t> m_clock;
+        std::atomic<std::uint64_t> m_hits;
+        std::atomic<std::uint64_t> m_misses;
+        std::atomic<std::uint64_t> m_evictions;
+    };
+
+    // shader parameters, addressed by the index returned from add()
+    class parameter_set {
+    public:
+        // at most 64 parameters, so a tile can record its dependencies in a bit mask
+        static const int max_parameters = 64;
+
+        int add(const float value) {
+            assert(this->size() < max_parameters);
+
+            m_values.push_back(value);
+
+            return static_cast<int>(m_values.size()) - 1;
+        }
+
+        void set(const int id, const float value) {
+            m_values[id] = value;
+        }
+
+        float get(const int id) const {
+            return m_values[id];
+        }
+
+        int size() const {
+            return static_cast<int>(m_values.size());
+        }
+
+    private:
+        std::vector<float> m_values;
+    };
+
+    // parameter access from a shader. every read is recorded as a dependency of the
+    // tile being shaded.
+    class shading_context {
+    public:
+        explicit shading_context(const parameter_set &parameters) : m_parameters(&parameters), m_dependencies(0) {}
+
+        float operator[] (const int id) const {
+            m_dependencies |= std::uint64_t(1) << id;
+
+            return m_parameters->get(id);
+        }
+
+        std::uint64_t dependencies() const {
+            return m_dependencies;
+        }
+
+    private:
+        const parameter_set *m_parameters;
+        mutable std::uint64_t m_dependencies;
+    };
+
+    // renders a shader into an image tile by tile, and on later renders only recomputes
+    // the tiles whose inputs changed. each tile keeps the set of parameters its shader
+    // calls read, and a hash of their values; a tile is redone when that hash changes or
+    // when a region covering it gets invalidated. the shader has to be a pure function of
+    // (context, u, v): then equal parameter values imply equal reads and equal pixels.
+    template<typename Shader>
+    class incremental_renderer {
+    public:
+        incremental_renderer(Shader shader, const int width, const int height, const int tile_size)
+            : m_shader(shader), m_width(width), m_height(height), m_tile_size(tile_size),
+              m_tiles_x((width + tile_size - 1) / tile_size), m_tiles_y((height + tile_size - 1) / tile_size),
+              m_pixels(width * height), m_tiles(m_tiles_x * m_tiles_y) {}
+
+        int width() const {
+            return m_width;
+        }
+
+        int height() const {
+            return m_height;
+        }
+
+        const float* pixels() const {
+            return m_pixels.data();
+        }
+
+        // brings the image up to date with 'parameters', and returns how many tiles were shaded
+        int render(const parameter_set &parameters) {
+            TRACE_SCOPE("incremental_renderer::render");
+
+            int rendered = 0;
+
+            for (int ty=0; ty<m_tiles_y; ty++) {
+                for (int tx=0; tx<m_tiles_x; tx++) {
+                    tile &t = m_tiles[ty*m_tiles_x + tx];
+
+                    if (!t.dirty && t.hash == hash(parameters, t.dependencies)) {
+                        continue;
+                    }
+
+                    t.dependencies = this->shade(parameters, tx, ty);
+                    t.hash = hash(parameters, t.dependencies);
+                    t.dirty = false;
+
+                    rendered++;
+                }
+            }
+
+            TRACE_COUNTER("tiles shaded", rendered);
+
+            return rendered;
+        }
+
+        // forces the tiles overlapping [u0, u1] x [v0, v1] to be shaded on the next render,
+        // for changes the parameters don't capture
+        void invalidate(const float u0, const float v0, const float u1, const float v1) {
+            const int x0 = texgen::clamp(static_cast<int>(u0 * m_width) / m_tile_size, 0, m_tiles_x - 1);
+            const int x1 = texgen::clamp(static_cast<int>(u1 * m_width) / m_tile_size, 0, m_tiles_x - 1);
+            const int y0 = texgen::clamp(static_cast<int>(v0 * m_height) / m_tile_size, 0, m_tiles_y - 1);
+            const int y1 = texgen::clamp(static_cast<int>(v1 * m_height) / m_tile_size, 0, m_tiles_y - 1);
+
+            for (int ty=y0; ty<=y1; ty++) {
+                for (int tx=x0; tx<=x1; tx++) {
+                    m_tiles[ty*m_tiles_x + tx].dirty = true;
+                }
+            }
+        }
+
+    private:
+        struct tile {
+            tile() : dependencies(0), hash(0), dirty(true) {}
+
+            std::uint64_t dependencies;
+            std::uint64_t hash;
+            bool dirty;
+        };
+
+        // FNV-1a over the dependency mask and the values it selects
+        static std::uint64_t hash(const parameter_set &parameters, const std::uint64_t dependencies) {
+            std::uint64_t h = 14695981039346656037ull;
+
+            const auto mix = [&h](std::uint64_t value) {
+                for (int i=0; i<8; i++) {
+                    h = (h ^ (value & 0xff)) * 1099511628211ull;
+                    value >>= 8;
+                }
+            };
+
+            mix(dependencies);
+
+            for (int id=0; id<parameters.size(); id++) {
+                if (dependencies & (std::uint64_t(1) << id)) {
+                    const float value = parameters.get(id);
+                    std::uint32_t bits;
+
+                    std::memcpy(&bits, &value, sizeof(bits));
+                    mix(bits);
+                }
+            }
+
+            return h;
+        }
+
+        std::uint64_t shade(const parameter_set &parameters, const int tx, const int ty) {
+            const shading_context context(parameters);
+
+            const int x1 = texgen::min((tx + 1) * m_tile_size, m_width);
+            const int y1 = texgen::min((ty + 1) * m_tile_size, m_height);
+
+            for (int y=ty*m_tile_size; y<y1; y++) {
+                const float v = (y + 0.5f) / m_height;
+
+                for (int x=tx*m_tile_size; x<x1; x++) {
+                    const float u = (x + 0.5f) / m_width;
+
+                    m_pixels[y*m_width + x] = m_shader(context, u, v);
+                }
+            }
+
+            return context.dependencies();
+        }
+
+    private:
+        Shader m_shader;
+        int m_width;
+        int m_height;
+        int m_tile_size;
+        int m_tiles_x;
+        int m_tiles_y;
+        std::vector<float> m_pixels;
+        std::vector<tile> m_tiles;
+    };
+
+    // tiled raw image file, for images too large to keep in memory. layout:
+    //  header: "TXTL", version, width, height, tile size, tiles x, tiles y (uint32 each),
+    //          padding (uint32), index offset (uint64)
+    //  tiles: tile_size*tile_size floats each, row-major inside the tile, in tile row
+    //         order; edge tiles are padded with zeros
+    //  index: byte offset and size (uint64 each) of every tile, in the same order
+    // all fields are stored in host byte order.
+    struct tiled_header {
+        char magic[4];
+        std::uint32_t version;
+        std::uint32_t width;
+        std::uint32_t height;
+        std::uint32_t tile_size;
+        std::uint32_t tiles_x;
+        std::uint32_t tiles_y;
+        std::uint32_t padding;
+        std::uint64_t index_offset;
+    };
+
+    // owns a FILE, so that it gets closed on every error path
+    struct file_closer {
+        void operator() (std::FILE *file) const {
+            std::fclose(file);
+        }
+    };
+
+    typedef std::unique_ptr<std::FILE, file_closer> file_handle;
+
+    inline void seek(std::FILE *file, const std::uint64_t offset) {
+#if defined(_MSC_VER)
+        const int result = ::_fseeki64(file, static_cast<__int64>(offset), SEEK_SET);
+#else
+        const int result = ::fseeko(file, static_cast<off_t>(offset), SEEK_SET);
+#endif
+        if (result != 0) {
+            throw std::runtime_error("texgen: seek failed");
+        }
+    }
+
+    // writes a tiled image one strip (a row of tiles) at a time. write_strip() hands the
+    // strip to a writer thread and returns the buffer of the previous one, so the caller
+    // renders the next strip while the last one goes to disk. at most two strips are
+    // alive at any time.
+    class tiled_writer {
+    public:
+        tiled_writer(const std::string &path, const int width, const int height, const int tile_size)
+            : m_file(std::fopen(path.c_str(), "wb")), m_offset(0), m_pending(false), m_closing(false), m_failed(false) {
+
+            if (!m_file) {
+                throw std::runtime_error("texgen: can't open " + path);
+            }
+
+            std::memcpy(m_header.magic, "TXTL", 4);
+            m_header.version = 1;
+            m_header.width = width;
+            m_header.height = height;
+            m_header.tile_size = tile_size;
+            m_header.tiles_x = (width + tile_size - 1) / tile_size;
+            m_header.tiles_y = (height + tile_size - 1) / tile_size;
+            m_header.padding = 0;
+            m_header.index_offset = 0;
+
+            // placeholder, rewritten with the index offset on close()
+            this->write(&m_header, sizeof(m_header));
+
+            m_thread = std::thread(&tiled_writer::run, this);
+        }
+
+        ~tiled_writer() {
+            if (m_file) {
+                try {
+                    this->close();
+                } catch (...) {}
+            }
+        }
+
+        const tiled_header& header() const {
+            return m_header;
+        }
+
+        std::size_t strip_size() const {
+            return std::size_t(m_header.tiles_x) * m_header.tile_size * m_header.tile_size;
+        }
+
+        // queues 'strip' for writing, and hands back a buffer for the next one
+        void write_strip(std::vector<float> &strip) {
+            assert(strip.size() == this->strip_size());
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            m_condition.wait(lock, [this]() { return !m_pending; });
+            this->check();
+
+            m_strip.swap(strip);
+            m_pending = true;
+            strip.resize(this->strip_size());
+
+            m_condition.notify_all();
+        }
+
+        // waits for the queued strips, then writes the index and the final header
+        void close() {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+
+                m_condition.wait(lock, [this]() { return !m_pending; });
+                m_closing = true;
+                m_condition.notify_all();
+            }
+
+            m_thread.join();
+
+            const file_handle file(std::move(m_file));
+
+            this->check();
+
+            m_header.index_offset = m_offset;
+
+            for (std::size_t i=0; i<m_index.size(); i++) {
+                write(file.get(), &m_index[i], sizeof(m_index[i]));
+            }
+
+            seek(file.get(), 0);
+            write(file.get(), &m_header, sizeof(m_header));
+        }
+
+    private:
+        struct index_entry {
+            std::uint64_t offset;
+            std::uint64_t bytes;
+        };
+
+        static void write(std::FILE *file, const void *data, const std::size_t bytes) {
+            if (std::fwrite(data, 1, bytes, file) != bytes) {
+                throw std::runtime_error("texgen: write failed");
+            }
+        }
+
+        void write(const void *data, const std::size_t bytes) {
+            write(m_file.get(), data, bytes);
+            m_offset += bytes;
+        }
+
+        void check() const {
+            if (m_failed) {
+                throw std::runtime_error("texgen: write failed");
+            }
+        }
+
+        void run() {
+            std::vector<float> strip;
+
+            for (;;) {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+
+                    m_condition.wait(lock, [this]() { return m_pending || m_closing; });
+
+                    if (!m_pending) {
+                        return;
+                    }
+
+                    strip.swap(m_strip);
+                }
+
+                // the strip is already tile-major, so it goes out in a single write
+                const std::size_t tile_bytes = sizeof(float) * m_header.tile_size * m_header.tile_size;
+
+                TRACE_SCOPE("tiled_writer::write");
+
+                try {
+                    for (std::uint32_t t=0; t<m_header.tiles_x; t++) {
+                        const index_entry entry = {m_offset + t*tile_bytes, tile_bytes};
+                        m_index.push_back(entry);
+                    }
+
+                    this->write(strip.data(), strip.size() * sizeof(float));
+                } catch (const std::runtime_error &) {
+                    m_failed = true;
+                }
+
+                std::unique_lock<std::mutex> lock(m_mutex);
+
+                m_strip.swap(strip);
+                m_pending = false;
+                m_condition.notify_all();
+            }
+        }
+
+    private:
+        file_handle m_file;
+        tiled_header m_header;
+        std::uint64_t m_offset;
+        std::vector<index_entry> m_index;
+
+        std::thread m_thread;
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        std::vector<float> m_strip;
+        bool m_pending;
+        bool m_closing;
+        bool m_failed;
+    };
+
+    // reads back single tiles of a tiled image
+    class tiled_reader {
+    public:
+        explicit tiled_reader(const std::string &path) : m_file(std::fopen(path.c_str(), "rb")) {
+            if (!m_file) {
+                throw std::runtime_error("texgen: can't open " + path);
+            }
+
+            this->read(&m_header, sizeof(m_header));
+
+            if (std::memcmp(m_header.magic, "TXTL", 4) != 0 || m_header.version != 1) {
+                throw std::runtime_error("texgen: " + path + " is not a tiled image");
+            }
+
+            // the placeholder header of a writer that never got closed has no index
+            if (m_header.index_offset < sizeof(m_header)) {
+                throw std::runtime_error("texgen: " + path + " is incomplete");
+            }
+
+            m_index.resize(std::size_t(m_header.tiles_x) * m_header.tiles_y * 2);
+
+            seek(m_file.get(), m_header.index_offset);
+            this->read(m_index.data(), m_index.size() * sizeof(std::uint64_t));
+        }
+
+        const tiled_header& header() const {
+            return m_header;
+        }
+
+        // reads tile_size*tile_size floats into 'texels'
+        void read_tile(const int tx, const int ty, float *texels) {
+            const std::size_t tile = std::size_t(ty) * m_header.tiles_x + tx;
+
+            seek(m_file.get(), m_index[2*tile]);
+            this->read(texels, static_cast<std::size_t>(m_index[2*tile + 1]));
+        }
+
+    private:
+        tiled_reader(const tiled_reader &);
+        tiled_reader& operator= (const tiled_reader &);
+
+        void read(void *data, const std::size_t bytes) {
+            if (std::fread(data, 1, bytes, m_file.get()) != bytes) {
+                throw std::runtime_error("texgen: read failed");
+            }
+        }
+
+    private:
+        file_handle m_file;
+        tiled_header m_header;
+        std::vector<std::uint64_t> m_index;
+    };
+
+    // renders shader(u, v) at the texel centers of a width x height image straight into a
+    // tiled file, strip by strip. peak memory is two strips, whatever the image size.
+    template<typename Shader>
+    void render_tiled(Shader shader, const int width, const int height, const int tile_size, const std::string &path) {
+        tiled_writer writer(path, width, height, tile_size);
+
+        const int tiles_x = writer.header().tiles_x;
+        const int tiles_y = writer.header().tiles_y;
+
+        std::vector<float> strip(writer.strip_size());
+
+        for (int ty=0; ty<tiles_y; ty++) {
+            TRACE_SCOPE("render_tiled strip");
+
+            for (int tx=0; tx<tiles_x; tx++) {
+                float *tile = &strip[std::size_t(tx) * tile_size * tile_size];
+
+                for (int j=0; j<tile_size; j++) {
+                    const int y = ty*tile_size + j;
+                    const float v = (y + 0.5f) / height;
+
+                    for (int i=0; i<tile_size; i++) {
+                        const int x = tx*tile_size + i;
+
+                        tile[j*tile_size + i] = (x < width && y < height) ? shader((x + 0.5f) / width, v) : 0.0f;
+                    }
+                }
+            }
+
+            writer.write_strip(strip);
+        }
+
+        writer.close();
+    }
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// scoped timers and counters for the hot loops, dumped as Chrome trace JSON
+// (chrome://tracing or ui.perfetto.dev). the macros only record anything when
+// TRACE_ENABLED is defined, and expand to nothing otherwise.
+#if defined(TRACE_ENABLED)
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+#define TRACE_SCOPE(name) const trace::scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_COUNTER(name, value) trace::counter(name, value)
+#define TRACE_DUMP(path) trace::write_json(path)
+#else
+#define TRACE_SCOPE(name) do {} while (0)
+#define TRACE_COUNTER(name, value) do {} while (0)
+#define TRACE_DUMP(path) do {} while (0)
+#endif
+
+namespace trace {
+    // names must be string literals, or outlive the dump
+    struct event {
+        const char *name;
+        char phase;
+        std::int64_t timestamp;
+        std::int64_t value;
+    };
+
+    inline std::int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // the events of one thread. only the owning thread writes, so recording is a plain
+    // store and a release increment; once full, the oldest events get overwritten.
+    class ring_buffer {
+    public:
+        static const std::size_t capacity = 1 << 16;
+
+        explicit ring_buffer(const int thread_id) : m_thread_id(thread_id), m_events(capacity), m_count(0) {}
+
+        int thread_id() const {
+            return m_thread_id;
+        }
+
+        void push(const event &e) {
+            const std::uint64_t count = m_count.load(std::memory_order_relaxed);
+
+            m_events[count % capacity] = e;
+            m_count.store(count + 1, std::memory_order_release);
+        }
+
+        // the recorded events, oldest first. meant to be called while the owner is idle.
+        std::vector<event> events() const {
+            const std::uint64_t count = m_count.load(std::memory_order_acquire);
+            const std::uint64_t first = count > capacity ? count - capacity : 0;
+
+            std::vector<event> result;
+            result.reserve(static_cast<std::size_t>(count - first));
+
+            for (std::uint64_t i=first; i<count; i++) {
+                result.push_back(m_events[i % capacity]);
+            }
+
+            return result;
+        }
+
+    private:
+        int m_thread_id;
+        std::vector<event> m_events;
+        std::atomic<std::uint64_t> m_count;
+    };
+
+    // owns the buffers of every thread that recorded something, so that they
+    // survive their threads until the dump
+    class registry {
+    public:
+        static registry &instance() {
+            static registry r;
+
+            return r;
+        }
+
+        // the buffer of the calling thread, registered on its first event
+        ring_buffer &local() {
+            thread_local ring_buffer *buffer = nullptr;
+
+            if (!buffer) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                m_buffers.emplace_back(new ring_buffer(static_cast<int>(m_buffers.size())));
+                buffer = m_buffers.back().get();
+            }
+
+            return *buffer;
+        }
+
+        std::vector<const ring_buffer*> buffers() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            std::vector<const ring_buffer*> result;
+
+            for (const auto &buffer : m_buffers) {
+                result.push_back(buffer.get());
+            }
+
+            return result;
+        }
+
+    private:
+        registry() {}
+
+        mutable std::mutex m_mutex;
+        std::vector<std::unique_ptr<ring_buffer>> m_buffers;
+    };
+
+    // records the time between its construction and its destruction
+    class scope {
+    public:
+        explicit scope(const char *name) : m_name(name), m_start(now()) {}
+
+        scope(const scope &) = delete;
+        scope &operator=(const scope &) = delete;
+
+        ~scope() {
+            const event e = {m_name, 'X', m_start, now() - m_start};
+
+            registry::instance().local().push(e);
+        }
+
+    private:
+        const char *m_name;
+        std::int64_t m_start;
+    };
+
+    inline void counter(const char *name, const std::int64_t value) {
+        const event e = {name, 'C', now(), value};
+
+        registry::instance().local().push(e);
+    }
+
+    // writes the events of all threads in the Chrome trace event format, with
+    // microsecond timestamps. returns false if the file can't be written.
+    inline bool write_json(const char *path) {
+        std::FILE *file = std::fopen(path, "w");
+
+        if (!file) {
+            return false;
+        }
+
+        std::fprintf(file, "{\"traceEvents\":[");
+
+        bool first = true;
+
+        for (const ring_buffer *buffer : registry::instance().buffers()) {
+            for (const event &e : buffer->events()) {
+                std::fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,", first ? "" : ",", e.name, e.phase, buffer->thread_id(), e.timestamp / 1000.0);
+
+                if (e.phase == 'X') {
+                    std::fprintf(file, "\"dur\":%.3f}", e.value / 1000.0);
+                } else {
+                    std::fprintf(file, "\"args\":{\"value\":%lld}}", static_cast<long long>(e.value));
+                }
+
+                first = false;
+            }
+        }
+
+        std::fprintf(file, "\n]}\n");
+
+        return std::fclose(file) == 0;
+    }
+}
@@ -1,8 +1,478 @@
 
 #include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <future>
+
+#include "expressions.hpp"
+#include "xe.hpp"
+#include "pipeline.hpp"
+#include "texgen.hpp"
+
+// performance regression harness: times a fixed workload of every kernel in the tree,
+// and compares the results against a baseline file.
+//
+//  Proto01 [--baseline path] [--threshold fraction] [--update]
+//
+// a missing baseline is recorded, and --update records it again. a recording measures
+// every workload in several runs, and keeps the spread between them, up to a few
+// percent, as the workload's own noise. the exit code is 1 when the median of a few
+// measurements of a workload is slower than the baseline by more than the threshold
+// and that noise, and by more than the uncertainty of both medians. a workload
+// missing from the baseline is recorded into it, with a warning.
+
+// a workload returns a value derived from its results, so that it can't be optimized away
+struct Workload {
+    std::string name;
+    std::function<double()> run;
+};
+
+struct Measurement {
+    double median;
+    double mad;
+    int samples;
+    // run-to-run spread, relative to the median
+    double spread;
+};
+
+namespace workloads {
+    double dotProduct() {
+        float array1[64], array2[64];
+
+        for (int i=0; i<64; i++) {
+            array1[i] = 1.0f / (i + 1);
+            array2[i] = static_cast<float>(i % 7);
+        }
+
+        float sum = 0.0f;
+
+        for (int i=0; i<(1 << 18); i++) {
+            const int offset = i % 48;
+
+            sum += lazy::dot<float, 16>(array1 + offset, array2 + offset);
+        }
+
+        return sum;
+    }
+
+    double integrate() {
+        Identity<double> x;
+
+        return ::integrate(x / (1.0 + x), 1.0, 5.0, 1 << 20);
+    }
+
+    double evaluate() {
+        static const double knots[] = {0.0, 0.0, 0.3, 1.0, 0.6, 1.0, 1.0};
+        const texgen::spline_curve<double> ramp(7, knots);
+
+        Identity<double> x;
+
+        auto shader = lazy::spline(ramp, lazy::smoothstep(1.0, 4.0, x) * (0.5 + 0.5 * lazy::sin(x * 3.0)));
+
+        std::vector<double> values(1 << 16), results(values.size());
+
+        for (size_t i=0; i<values.size(); i++) {
+            values[i] = 1.0 + 4.0 * i / values.size();
+        }
+
+        lazy::evaluate(shader, values.data(), results.data(), values.size());
+
+        return results[results.size() / 3];
+    }
+
+    double vectors() {
+        std::vector<xe::Vector> v1, v2, v3, v4;
+
+        for (int i=0; i<4096; i++) {
+            const float f = static_cast<float>(i);
+
+            v1.push_back(xe::Vector(f, 1.0f, 2.0f));
+            v2.push_back(xe::Vector(-1.0f, f, 0.0f));
+            v3.push_back(xe::Vector(0.0f, -2.0f, f));
+            v4.push_back(xe::Vector(1.0f, 0.0f, -f));
+        }
+
+        float sum = 0.0f;
+
+        for (int pass=0; pass<8; pass++) {
+            for (size_t i=0; i<v1.size(); i++) {
+                const xe::Vector result = v1[i] + v2[i] - v3[i] + v4[i];
+
+                sum += result[0] + result[1] + result[2];
+            }
+        }
+
+        return sum;
+    }
+
+    // four operands of an xe vector expression
+    struct VectorRequest {
+        xe::Vector v1, v2, v3, v4;
+    };
+
+    // the same expressions as vectors(), submitted one by one to a batch pipeline
+    double asyncVectors() {
+        static lazy::BatchPipeline<VectorRequest, xe::Vector> pipeline([](const VectorRequest *requests, xe::Vector *results, const size_t count) {
+            for (size_t i=0; i<count; i++) {
+                results[i] = requests[i].v1 + requests[i].v2 - requests[i].v3 + requests[i].v4;
+            }
+        }, 2, 1024, 64);
+
+        std::vector<std::future<xe::Vector>> futures;
+
+        for (int i=0; i<4096; i++) {
+            const float f = static_cast<float>(i);
+            const VectorRequest request = {xe::Vector(f, 1.0f, 2.0f), xe::Vector(-1.0f, f, 0.0f), xe::Vector(0.0f, -2.0f, f), xe::Vector(1.0f, 0.0f, -f)};
+
+            futures.push_back(pipeline.submit(request));
+        }
+
+        float sum = 0.0f;
+
+        for (std::future<xe::Vector> &future : futures) {
+            const xe::Vector result = future.get();
+
+            sum += result[0] + result[1] + result[2];
+        }
+
+        return sum;
+    }
+
+    double packets() {
+        typedef texgen::float8 float8;
+
+        float sum = 0.0f;
+
+        for (int y=0; y<256; y++) {
+            const float8 v(y / 256.0f);
+
+            for (int x=0; x<256; x+=float8::size()) {
+                float8 u;
+
+                for (int i=0; i<float8::size(); i++) {
+                    u[i] = (x + i) / 256.0f;
+                }
+
+                const float8 value = texgen::smoothstep(float8(0.25f), float8(0.75f), texgen::mod(u*float8(3.0f) + v, float8(1.0f)));
+                const float8 wave = texgen::sin(float8(8.0f)*u + float8(4.0f)*v);
+
+                for (int i=0; i<float8::size(); i++) {
+                    sum += value[i] * wave[i];
+                }
+            }
+        }
+
+        return sum;
+    }
+
+    double noise() {
+        static const texgen::gradient_noise noise(42);
+
+        float sum = 0.0f;
+
+        for (int y=0; y<128; y++) {
+            for (int x=0; x<128; x++) {
+                sum += noise.turbulence(x / 32.0f, y / 32.0f, 0.5f, 4);
+            }
+        }
+
+        return sum;
+    }
+
+    double spline() {
+        static const float knots[] = {0.0f, 0.0f, 0.3f, 1.0f, 0.6f, 1.0f, 1.0f};
+        const texgen::spline_curve<float> ramp(7, knots);
+
+        std::vector<float> values(1 << 16), results(values.size());
+
+        for (size_t i=0; i<values.size(); i++) {
+            values[i] = static_cast<float>(i) / values.size();
+        }
+
+        ramp.evaluate(values.data(), results.data(), values.size());
+
+        return results[results.size() / 3];
+    }
+}
+
+double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+
+    const size_t n = values.size();
+
+    return n % 2 ? values[n / 2] : 0.5 * (values[n/2 - 1] + values[n / 2]);
+}
+
+// median absolute deviation
+double mad(const std::vector<double> &values, const double center) {
+    std::vector<double> deviations;
+
+    for (const double value : values) {
+        deviations.push_back(std::abs(value - center));
+    }
+
+    return median(deviations);
+}
+
+// repeats the workload for at least the minimum time, so that short workloads don't
+// stop on a lucky streak, and then until the spread of its timings is small compared to
+// their median, or the time budget runs out
+Measurement measure(const Workload &workload, double &sink) {
+    const int minSamples = 10;
+    const int maxSamples = 200;
+    const double minTime = 0.5;
+    const double tolerance = 0.02;
+    const double budget = 3.0;
+
+    typedef std::chrono::steady_clock Clock;
+
+    // warm up caches and lazily built tables
+    sink += workload.run();
+
+    std::vector<double> samples;
+    const auto start = Clock::now();
+
+    for (;;) {
+        const auto begin = Clock::now();
+        sink += workload.run();
+        const auto end = Clock::now();
+
+        samples.push_back(std::chrono::duration<double, std::micro>(end - begin).count());
+
+        const int count = static_cast<int>(samples.size());
+        const double elapsed = std::chrono::duration<double>(end - start).count();
+
+        if (count < minSamples || elapsed < minTime) {
+            continue;
+        }
+
+        const double center = median(samples);
+        const double spread = mad(samples, center);
+
+        if (spread <= tolerance*center || count >= maxSamples || elapsed > budget) {
+            return Measurement{center, spread, count, 0.0};
+        }
+    }
+}
+
+// the measurement with the median timing
+Measurement medianMeasurement(std::vector<Measurement> measurements) {
+    std::sort(measurements.begin(), measurements.end(), [](const Measurement &m1, const Measurement &m2) { return m1.median < m2.median; });
+
+    return measurements[measurements.size() / 2];
+}
+
+// measures the workload in independent runs, and keeps the median one along with the
+// spread between the runs, which the noise within a single run doesn't show
+Measurement measureRuns(const Workload &workload, double &sink, const int runs) {
+    std::vector<Measurement> measurements;
+
+    for (int run=0; run<runs; run++) {
+        measurements.push_back(measure(workload, sink));
+    }
+
+    const auto fastest = std::min_element(measurements.begin(), measurements.end(), [](const Measurement &m1, const Measurement &m2) { return m1.median < m2.median; });
+    const auto slowest = std::max_element(measurements.begin(), measurements.end(), [](const Measurement &m1, const Measurement &m2) { return m1.median < m2.median; });
+
+    Measurement result = medianMeasurement(measurements);
+    result.spread = (slowest->median - fastest->median) / result.median;
+
+    return result;
+}
+
+std::map<std::string, Measurement> readBaseline(const std::string &path) {
+    std::map<std::string, Measurement> baseline;
+    std::ifstream file(path);
+    std::string line;
+
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        std::string name;
+        Measurement measurement = {0.0, 0.0, 0, 0.0};
+
+        if (fields >> name >> measurement.median >> measurement.mad >> measurement.samples) {
+            // baselines recorded without the spread column allow for no run-to-run noise
+            if (!(fields >> measurement.spread)) {
+                measurement.spread = 0.0;
+            }
+
+            baseline[name] = measurement;
+        }
+    }
+
+    return baseline;
+}
+
+bool writeBaseline(const std::string &path, const std::map<std::string, Measurement> &measurements) {
+    std::ofstream file(path);
+
+    file << "# workload median(us) mad(us) samples spread" << std::endl;
+
+    for (const auto &entry : measurements) {
+        file << entry.first << " " << entry.second.median << " " << entry.second.mad << " " << entry.second.samples << " " << entry.second.spread << std::endl;
+    }
+
+    return static_cast<bool>(file);
+}
+
+// standard error of a median, from the MAD: 1.4826 MAD estimates the standard deviation,
+// and the median of n samples is about 1.25 times noisier than their mean
+double medianError(const Measurement &measurement) {
+    return 1.2533 * 1.4826 * measurement.mad / std::sqrt(static_cast<double>(std::max(measurement.samples, 1)));
+}
+
+// slower by more than the threshold plus the run-to-run spread of the baseline, and by
+// more than three standard errors of the difference of the medians. the spread is
+// capped, so that a noisy recording can't switch the check off.
+bool isRegression(const Measurement &baseline, const Measurement &current, const double threshold) {
+    const double maxSpread = 0.05;
+
+    const double spread = std::min(baseline.spread, maxSpread);
+    const double noise = 3.0 * std::hypot(medianError(baseline), medianError(current));
+
+    return current.median > baseline.median * (1.0 + threshold + spread) && current.median - baseline.median > noise;
+}
+
+int main(int argc, char **argv) {
+    std::string baselinePath = "Proto01.baseline";
+    double threshold = 0.10;
+    bool update = false;
+
+    for (int i=1; i<argc; i++) {
+        const std::string arg = argv[i];
+
+        if (arg == "--baseline" && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (arg == "--threshold" && i + 1 < argc) {
+            threshold = std::atof(argv[++i]);
+        } else if (arg == "--update") {
+            update = true;
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--baseline path] [--threshold fraction] [--update]" << std::endl;
+            return 2;
+        }
+    }
+
+    const std::vector<Workload> suite = {
+        {"dot_product", workloads::dotProduct},
+        {"integrate", workloads::integrate},
+        {"lazy_evaluate", workloads::evaluate},
+        {"xe_vectors", workloads::vectors},
+        {"xe_async_vectors", workloads::asyncVectors},
+        {"texgen_packets", workloads::packets},
+        {"texgen_noise", workloads::noise},
+        {"texgen_spline", workloads::spline}
+    };
+
+    const std::map<std::string, Measurement> baseline = readBaseline(baselinePath);
+    const bool record = update || baseline.empty();
+
+    const int recordRuns = 3;
+    const int retries = 2;
+
+    std::map<std::string, Measurement> measurements;
+    std::vector<std::string> missing;
+    double sink = 0.0;
+    int regressions = 0;
+
+    std::cout << std::fixed << std::setprecision(1);
+
+    for (const Workload &workload : suite) {
+        const auto entry = baseline.find(workload.name);
+        const bool compare = !record && entry != baseline.end();
+
+        if (!record && !compare) {
+            missing.push_back(workload.name);
+        }
+
+        Measurement measurement = compare ? measure(workload, sink) : measureRuns(workload, sink, recordRuns);
+        int remeasured = 0;
+
+        // a suspected regression is measured again, and the median of the measurements
+        // counts, so that one slow or one fast outlier doesn't decide
+        if (compare && isRegression(entry->second, measurement, threshold)) {
+            std::vector<Measurement> measured = {measurement};
+
+            for (remeasured=0; remeasured<retries; remeasured++) {
+                measured.push_back(measure(workload, sink));
+            }
+
+            measurement = medianMeasurement(measured);
+        }
+
+        measurements[workload.name] = measurement;
+
+        std::cout << std::left << std::setw(16) << workload.name << std::right
+            << std::setw(10) << measurement.median << " us +- " << std::setw(7) << measurement.mad << " us (" << measurement.samples << " samples)";
+
+        if (!compare) {
+            std::cout << "  runs within " << 100.0*measurement.spread << "%";
+        }
+
+        if (compare) {
+            const double change = 100.0 * (measurement.median / entry->second.median - 1.0);
+
+            std::cout << "  " << std::showpos << change << std::noshowpos << "%";
+
+            if (isRegression(entry->second, measurement, threshold)) {
+                std::cout << "  REGRESSION";
+                regressions++;
+            }
+
+            if (remeasured > 0) {
+                std::cout << "  (measured " << remeasured + 1 << " times)";
+            }
+        }
+
+        std::cout << std::endl;
+    }
+
+    // keeps the results alive
+    if (sink == 0.0) {
+        std::cout << std::endl;
+    }
+
+    if (record) {
+        if (!writeBaseline(baselinePath, measurements)) {
+            std::cerr << "can't write " << baselinePath << std::endl;
+            return 2;
+        }
+
+        std::cout << "baseline recorded to " << baselinePath << std::endl;
+        return 0;
+    }
+
+    if (!missing.empty()) {
+        std::map<std::string, Measurement> merged = baseline;
+
+        for (const std::string &name : missing) {
+            std::cerr << "warning: " << name << " is not in " << baselinePath << ", adding it" << std::endl;
+            merged[name] = measurements[name];
+        }
+
+        if (!writeBaseline(baselinePath, merged)) {
+            std::cerr << "can't write " << baselinePath << std::endl;
+            return 2;
+        }
+    }
+
+    if (regressions > 0) {
+        std::cout << regressions << " regression(s) beyond " << 100.0*threshold << "%" << std::endl;
+        return 1;
+    }
 
-int main() {
-    
- 
     return 0;
 }
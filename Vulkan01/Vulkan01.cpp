@@ -1,10 +1,35 @@
 
+// without GLFW there is no window, and only the headless mode is available
+#if defined(VULKAN01_WITH_GLFW)
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
+#else
+#include <vulkan/vulkan.h>
+#endif
 
 #include <iostream>
 #include <cassert>
 #include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+#include <mutex>
+#include <functional>
+#include <stdexcept>
+
+#include "texgen.hpp"
+
+// SPIR-V of texture.comp, generated at build time
+#include "texture.comp.h"
 
 const std::vector<const char*> enabledLayers = {
 #if defined(_DEBUG)
@@ -19,6 +44,334 @@ const std::vector<const char *> enabledExtensions = {
 static const int ScreenWidth = 1024;
 static const int ScreenHeight = 768;
 
+// host memory allocator handed to the driver through VkAllocationCallbacks.
+// each allocation scope gets its own pools of fixed size blocks, so that short
+// lived command allocations don't fragment the memory of long lived objects,
+// and keeps track of its allocation counts and bytes.
+class HostAllocator {
+public:
+    struct Statistics {
+        size_t allocations = 0;
+        size_t reallocations = 0;
+        size_t frees = 0;
+        size_t bytes = 0;
+        size_t peakBytes = 0;
+        size_t internalBytes = 0;
+    };
+
+    HostAllocator() {
+        m_callbacks.pUserData = this;
+        m_callbacks.pfnAllocation = &HostAllocator::allocation;
+        m_callbacks.pfnReallocation = &HostAllocator::reallocation;
+        m_callbacks.pfnFree = &HostAllocator::free;
+        m_callbacks.pfnInternalAllocation = &HostAllocator::internalAllocation;
+        m_callbacks.pfnInternalFree = &HostAllocator::internalFree;
+    }
+
+    HostAllocator(const HostAllocator &) = delete;
+    HostAllocator &operator=(const HostAllocator &) = delete;
+
+    ~HostAllocator() {
+        for (Scope &scope : m_scopes) {
+            for (void *chunk : scope.chunks) {
+                std::free(chunk);
+            }
+        }
+    }
+
+    const VkAllocationCallbacks *callbacks() const {
+        return &m_callbacks;
+    }
+
+    Statistics statistics(const VkSystemAllocationScope scope) const {
+        std::lock_guard<std::mutex> lock(m_scopes[scope].mutex);
+
+        return m_scopes[scope].statistics;
+    }
+
+    void display() const {
+        static const char *names[ScopeCount] = {"command", "object", "cache", "device", "instance"};
+
+        std::cout << "Host allocations:" << std::endl;
+
+        for (int i=0; i<ScopeCount; i++) {
+            const Statistics statistics = this->statistics(static_cast<VkSystemAllocationScope>(i));
+
+            std::cout << "\t" << names[i] << ": " 
+                << statistics.allocations << " allocations, " 
+                << statistics.reallocations << " reallocations, " 
+                << statistics.frees << " frees, " 
+                << statistics.bytes << " bytes, " 
+                << statistics.peakBytes << " peak bytes, " 
+                << statistics.internalBytes << " internal bytes" << std::endl;
+        }
+    }
+
+private:
+    // blocks from 64 bytes to 8 KiB come from the pools, bigger ones from the heap
+    static const int ScopeCount = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+    static const int ClassCount = 8;
+    static const size_t MinBlockSize = 64;
+    static const size_t ChunkSize = 64 * 1024;
+    static const uint32_t LargeClass = ClassCount;
+
+    // precedes each allocation
+    struct alignas(16) Header {
+        void *block;
+        size_t size;
+        uint32_t sizeClass;
+        uint32_t scope;
+    };
+
+    struct Block {
+        Block *next;
+    };
+
+    struct Scope {
+        mutable std::mutex mutex;
+        Block *freeBlocks[ClassCount] = {};
+        std::vector<void*> chunks;
+        Statistics statistics;
+    };
+
+    static size_t blockSize(const uint32_t sizeClass) {
+        return MinBlockSize << sizeClass;
+    }
+
+    static Header *header(void *memory) {
+        return reinterpret_cast<Header*>(memory) - 1;
+    }
+
+    void *allocate(const size_t size, const size_t alignment, const VkSystemAllocationScope scopeIndex) {
+        // the header sits right before the aligned pointer
+        const size_t requiredSize = size + sizeof(Header) + (alignment > alignof(Header) ? alignment - 1 : 0);
+
+        uint32_t sizeClass = 0;
+
+        while (sizeClass < ClassCount && blockSize(sizeClass) < requiredSize) {
+            sizeClass++;
+        }
+
+        Scope &scope = m_scopes[scopeIndex];
+        void *block = nullptr;
+
+        if (sizeClass < ClassCount) {
+            std::lock_guard<std::mutex> lock(scope.mutex);
+
+            block = this->popBlock(scope, sizeClass);
+        } else {
+            block = std::malloc(requiredSize);
+        }
+
+        if (!block) {
+            return nullptr;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(scope.mutex);
+
+            scope.statistics.allocations++;
+            scope.statistics.bytes += size;
+            scope.statistics.peakBytes = std::max(scope.statistics.peakBytes, scope.statistics.bytes);
+        }
+
+        const uintptr_t address = reinterpret_cast<uintptr_t>(block) + sizeof(Header);
+        const uintptr_t mask = static_cast<uintptr_t>(std::max(alignment, alignof(Header)) - 1);
+
+        void *memory = reinterpret_cast<void*>((address + mask) & ~mask);
+
+        Header *memoryHeader = header(memory);
+        memoryHeader->block = block;
+        memoryHeader->size = size;
+        memoryHeader->sizeClass = sizeClass;
+        memoryHeader->scope = scopeIndex;
+
+        return memory;
+    }
+
+    void deallocate(void *memory) {
+        if (!memory) {
+            return;
+        }
+
+        const Header memoryHeader = *header(memory);
+        Scope &scope = m_scopes[memoryHeader.scope];
+
+        {
+            std::lock_guard<std::mutex> lock(scope.mutex);
+
+            scope.statistics.frees++;
+            scope.statistics.bytes -= memoryHeader.size;
+
+            if (memoryHeader.sizeClass < ClassCount) {
+                Block *block = static_cast<Block*>(memoryHeader.block);
+                block->next = scope.freeBlocks[memoryHeader.sizeClass];
+                scope.freeBlocks[memoryHeader.sizeClass] = block;
+            }
+        }
+
+        if (memoryHeader.sizeClass == LargeClass) {
+            std::free(memoryHeader.block);
+        }
+    }
+
+    void *reallocate(void *original, const size_t size, const size_t alignment, const VkSystemAllocationScope scope) {
+        if (!original) {
+            return this->allocate(size, alignment, scope);
+        }
+
+        if (size == 0) {
+            this->deallocate(original);
+
+            return nullptr;
+        }
+
+        // the original memory must stay untouched if the allocation fails
+        void *memory = this->allocate(size, alignment, scope);
+
+        if (memory) {
+            std::memcpy(memory, original, std::min(size, header(original)->size));
+            this->deallocate(original);
+
+            std::lock_guard<std::mutex> lock(m_scopes[scope].mutex);
+
+            m_scopes[scope].statistics.reallocations++;
+        }
+
+        return memory;
+    }
+
+    // takes a free block of the class, carving a new chunk when there is none
+    Block *popBlock(Scope &scope, const uint32_t sizeClass) {
+        if (!scope.freeBlocks[sizeClass]) {
+            char *chunk = static_cast<char*>(std::malloc(ChunkSize));
+
+            if (!chunk) {
+                return nullptr;
+            }
+
+            scope.chunks.push_back(chunk);
+
+            const size_t size = blockSize(sizeClass);
+
+            for (size_t offset = 0; offset + size <= ChunkSize; offset += size) {
+                Block *block = reinterpret_cast<Block*>(chunk + offset);
+                block->next = scope.freeBlocks[sizeClass];
+                scope.freeBlocks[sizeClass] = block;
+            }
+        }
+
+        Block *block = scope.freeBlocks[sizeClass];
+        scope.freeBlocks[sizeClass] = block->next;
+
+        return block;
+    }
+
+    static VKAPI_ATTR void* VKAPI_CALL allocation(void *userData, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+        return static_cast<HostAllocator*>(userData)->allocate(size, alignment, scope);
+    }
+
+    static VKAPI_ATTR void* VKAPI_CALL reallocation(void *userData, void *original, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+        return static_cast<HostAllocator*>(userData)->reallocate(original, size, alignment, scope);
+    }
+
+    static VKAPI_ATTR void VKAPI_CALL free(void *userData, void *memory) {
+        static_cast<HostAllocator*>(userData)->deallocate(memory);
+    }
+
+    // the driver reports the memory it allocates by itself, e.g. for executable code
+    static VKAPI_ATTR void VKAPI_CALL internalAllocation(void *userData, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope) {
+        HostAllocator *allocator = static_cast<HostAllocator*>(userData);
+        std::lock_guard<std::mutex> lock(allocator->m_scopes[scope].mutex);
+
+        allocator->m_scopes[scope].statistics.internalBytes += size;
+    }
+
+    static VKAPI_ATTR void VKAPI_CALL internalFree(void *userData, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope) {
+        HostAllocator *allocator = static_cast<HostAllocator*>(userData);
+        std::lock_guard<std::mutex> lock(allocator->m_scopes[scope].mutex);
+
+        allocator->m_scopes[scope].statistics.internalBytes -= size;
+    }
+
+private:
+    VkAllocationCallbacks m_callbacks = {};
+    Scope m_scopes[ScopeCount];
+};
+
+// measures consecutive phases of the application startup
+class StartupTimer {
+public:
+    StartupTimer() : m_start(Clock::now()), m_last(m_start) {}
+
+    // ends the current phase, and starts the next one
+    void mark(const char *phase) {
+        const auto now = Clock::now();
+
+        m_phases.push_back({phase, std::chrono::duration<double, std::milli>(now - m_last).count()});
+        m_last = now;
+    }
+
+    void display() const {
+        std::cout << "Startup:" << std::endl;
+
+        for (const Phase &phase : m_phases) {
+            std::cout << "\t" << phase.name << ": " << phase.milliseconds << " ms" << std::endl;
+        }
+
+        std::cout << "\ttotal: " << std::chrono::duration<double, std::milli>(m_last - m_start).count() << " ms" << std::endl;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Phase {
+        const char *name;
+        double milliseconds;
+    };
+
+    Clock::time_point m_start;
+    Clock::time_point m_last;
+    std::vector<Phase> m_phases;
+};
+
+// push constants of texture.comp
+struct TextureParameters {
+    uint32_t width;
+    uint32_t height;
+    float frequency;
+    float edge0;
+    float edge1;
+};
+
+// CPU version of texture.comp, shaded in packets
+std::vector<float> renderTexture(const TextureParameters &parameters) {
+    typedef texgen::float8 float8;
+
+    std::vector<float> texels(parameters.width * parameters.height);
+
+    for (uint32_t y=0; y<parameters.height; y++) {
+        const float v = (y + 0.5f) / parameters.height;
+
+        for (uint32_t x=0; x<parameters.width; x+=float8::size()) {
+            float8 u;
+
+            for (int i=0; i<float8::size(); i++) {
+                u[i] = (x + i + 0.5f) / parameters.width;
+            }
+
+            const float8 value = float8(0.5f) + float8(0.5f)*texgen::sin<texgen::precise>(float8(parameters.frequency) * (u + float8(v)));
+            const float8 texel = texgen::smoothstep(float8(parameters.edge0), float8(parameters.edge1), value);
+
+            for (int i=0; i<float8::size() && x + i < parameters.width; i++) {
+                texels[y*parameters.width + x + i] = texel[i];
+            }
+        }
+    }
+
+    return texels;
+}
+
 static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
     VkDebugReportFlagsEXT flags, 
     VkDebugReportObjectTypeEXT objectType, 
@@ -56,55 +409,140 @@ void DestroyDebugReportCallbackEXT(VkInstance instance, VkDebugReportCallbackEXT
     }
 }
 
+// the failure of a Vulkan call, reported by main() with a non-zero exit code
+void check(const VkResult result, const char *call) {
+    if (result != VK_SUCCESS) {
+        std::ostringstream message;
+        message << call << " failed with VkResult " << result;
+
+        throw std::runtime_error(message.str());
+    }
+}
+
+// calls a function when leaving the scope, whether normally or by an exception
+class ScopeExit {
+public:
+    explicit ScopeExit(std::function<void()> function) : m_function(function) {}
+
+    ScopeExit(const ScopeExit &) = delete;
+    ScopeExit &operator=(const ScopeExit &) = delete;
+
+    ~ScopeExit() {
+        m_function();
+    }
+
+private:
+    std::function<void()> m_function;
+};
+
 class Application {
 public:
-    Application() {
+    // a headless application has no window, and runs on any device with a compute
+    // queue, including CPU implementations like lavapipe.
+    // a verbose application displays the available extensions and layers.
+    explicit Application(const bool headless = false, const bool verbose = false) : m_headless(headless), m_verbose(verbose) {
+#if defined(VULKAN01_WITH_GLFW)
+        if (!m_headless) {
             // initialize glfw
-        ::glfwInit();
-        ::glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-        ::glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+            ::glfwInit();
+            ::glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+            ::glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
     
-        m_window = ::glfwCreateWindow(ScreenWidth, ScreenHeight, "Vulkan 01", nullptr, nullptr);
-        assert(m_window);
+            m_window = ::glfwCreateWindow(ScreenWidth, ScreenHeight, "Vulkan 01", nullptr, nullptr);
+            assert(m_window);
+
+            m_timer.mark("window");
+        }
+#else
+        assert(m_headless);
+#endif
 
+        // the extensions are needed to tell if debug reports are available, while
+        // the layers, slow to enumerate as the loader reads their manifests, are
+        // only needed to display them or to enable the validation ones
         const auto extensions = this->enumerateExtensions();
-        const auto layers = this->enumerateLayers();
+        std::vector<VkLayerProperties> layers;
 
-        displayInfo(extensions, layers);
+        if (m_verbose || !enabledLayers.empty()) {
+            layers = this->enumerateLayers();
+        }
+
+        if (m_verbose) {
+            displayInfo(extensions, layers);
+        }
+
+        m_timer.mark("enumeration");
 
         // create vulkan instance
-        auto requiredExtensions = this->getRequiredExtensions();
+        auto requiredExtensions = this->getRequiredExtensions(extensions);
 
         VkApplicationInfo appInfo = this->createApplicationInfo();
         VkInstanceCreateInfo instanceInfo = this->createInstanceInfo(&appInfo, layers, enabledLayers, requiredExtensions);
 
-        VkResult result = ::vkCreateInstance(&instanceInfo, nullptr, &m_instance);
+        check(::vkCreateInstance(&instanceInfo, m_allocator.callbacks(), &m_instance), "vkCreateInstance");
     
-        m_debugCallback = setupDebug(m_instance);
+        if (checkExtension(extensions, "VK_EXT_debug_report")) {
+            m_debugCallback = setupDebug(m_instance);
+        }
+
+        m_timer.mark("instance");
+
+        m_queueFlags = m_headless ? VK_QUEUE_COMPUTE_BIT : VK_QUEUE_GRAPHICS_BIT;
 
         this->pickPhysicalDevice();
 
+        if (m_physicalDevice == VK_NULL_HANDLE) {
+            throw std::runtime_error(m_headless ? "no device has a compute queue" : "no device has a graphics queue");
+        }
+
+        m_timer.mark("physical device");
+
         m_device = this->createDevice();
 
         vkGetDeviceQueue(m_device, m_familyIndex, 0, &m_queue);
 
-        assert(result == VK_SUCCESS);
+        m_timer.mark("device");
+
+        m_pipelineCache = this->createPipelineCache();
+
+        m_timer.mark("pipeline cache");
     }
 
     int run() {
+        if (m_headless) {
+            return this->runCompute();
+        }
+
+        m_timer.display();
+        m_allocator.display();
+
+#if defined(VULKAN01_WITH_GLFW)
         while (!::glfwWindowShouldClose(m_window)) {
             ::glfwPollEvents();
         }
+#endif
 
         return 0;
     }
 
     ~Application() {
-        ::DestroyDebugReportCallbackEXT(m_instance, m_debugCallback, nullptr);
+        this->savePipelineCache();
+
+        ::vkDestroyPipelineCache(m_device, m_pipelineCache, m_allocator.callbacks());
+        ::vkDestroyDevice(m_device, m_allocator.callbacks());
+
+        if (m_debugCallback != VK_NULL_HANDLE) {
+            ::DestroyDebugReportCallbackEXT(m_instance, m_debugCallback, m_allocator.callbacks());
+        }
+
+        ::vkDestroyInstance(m_instance, m_allocator.callbacks());
 
-        ::vkDestroyInstance(m_instance, nullptr);
-        ::glfwDestroyWindow(m_window);
-        ::glfwTerminate();
+#if defined(VULKAN01_WITH_GLFW)
+        if (!m_headless) {
+            ::glfwDestroyWindow(m_window);
+            ::glfwTerminate();
+        }
+#endif
     }
 
 protected:
@@ -139,6 +577,16 @@ protected:
         return true;
     }
 
+    bool checkExtension(const std::vector<VkExtensionProperties> &extensions, const std::string &extensionName) {
+        for (const VkExtensionProperties &extension : extensions) {
+            if (extensionName == extension.extensionName) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
     std::vector<VkExtensionProperties> enumerateExtensions() {
         std::uint32_t propertiesCount;
         std::vector<VkExtensionProperties> properties;
@@ -163,20 +611,28 @@ protected:
         return appInfo;
     }
 
-    std::vector<const char *> getRequiredExtensions() {
+    std::vector<const char *> getRequiredExtensions(const std::vector<VkExtensionProperties> &available) {
 
         // populate extensions
         std::vector<const char *> extensions;
 
-        unsigned glfwExtensionCount = 0;
-        const char **glfwExtensions = ::glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+#if defined(VULKAN01_WITH_GLFW)
+        if (!m_headless) {
+            unsigned glfwExtensionCount = 0;
+            const char **glfwExtensions = ::glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-        for (unsigned i=0; i<glfwExtensionCount; i++) {
-            extensions.push_back(glfwExtensions[i]);
+            for (unsigned i=0; i<glfwExtensionCount; i++) {
+                extensions.push_back(glfwExtensions[i]);
+            }
         }
+#endif
 
-        // append application required extensions
-        extensions.insert(extensions.end(), enabledExtensions.begin(), enabledExtensions.end());
+        // append the application extensions the implementation has
+        for (const char *extension : enabledExtensions) {
+            if (checkExtension(available, extension)) {
+                extensions.push_back(extension);
+            }
+        }
 
         return extensions;
     }
@@ -223,9 +679,11 @@ protected:
         createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
         createInfo.pfnCallback = debugCallback;
 
-        VkResult result = ::CreateDebugReportCallbackEXT(instance, &createInfo, nullptr, &callback);
-
-        assert(result == VK_SUCCESS);
+        // debug reports are a convenience, so the application goes on without them
+        if (::CreateDebugReportCallbackEXT(instance, &createInfo, m_allocator.callbacks(), &callback) != VK_SUCCESS) {
+            std::cerr << "debug reports are unavailable" << std::endl;
+            return VK_NULL_HANDLE;
+        }
 
         return callback;
     }
@@ -260,7 +718,7 @@ protected:
 
         for (const auto device : devices) {
             const auto families = this->enumerateFamilies(device);
-            const int familyIndex = searchPhysicalDevice(families, VK_QUEUE_GRAPHICS_BIT);
+            const int familyIndex = searchPhysicalDevice(families, m_queueFlags);
 
             if (familyIndex >= 0) {
                 m_familyIndex = familyIndex;
@@ -282,7 +740,7 @@ protected:
 
     VkDevice createDevice() {
         const auto families = this->enumerateFamilies(m_physicalDevice);
-        const int familyIndex = this->searchPhysicalDevice(families, VK_QUEUE_GRAPHICS_BIT);
+        const int familyIndex = this->searchPhysicalDevice(families, m_queueFlags);
 
         const float priority = 1.0f;
 
@@ -299,29 +757,420 @@ protected:
         createInfo.pQueueCreateInfos = &queueInfo;
         createInfo.queueCreateInfoCount = 1;
         createInfo.pEnabledFeatures = &deviceFeatures;
-        createInfo.enabledExtensionCount = 1;
+        createInfo.enabledExtensionCount = 0;
         createInfo.enabledLayerCount = (uint32_t)enabledLayers.size();
         createInfo.ppEnabledLayerNames = enabledLayers.data();
 
         VkDevice device;
-        VkResult result = ::vkCreateDevice(m_physicalDevice, &createInfo, nullptr, &device);
-
-        assert(result == VK_SUCCESS);
+        check(::vkCreateDevice(m_physicalDevice, &createInfo, m_allocator.callbacks(), &device), "vkCreateDevice");
 
         return device;
     }
 
+    // the cache file name identifies the device and driver which produced it,
+    // so that switching either one starts from an empty cache
+    std::string getPipelineCachePath() const {
+        VkPhysicalDeviceProperties properties;
+        ::vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+
+        std::ostringstream path;
+        path << std::hex << std::setfill('0');
+        path << "Vulkan01-" << std::setw(4) << properties.vendorID << "-" << std::setw(4) << properties.deviceID << "-";
+
+        for (uint32_t i=0; i<VK_UUID_SIZE; i++) {
+            path << std::setw(2) << (unsigned)properties.pipelineCacheUUID[i];
+        }
+
+        path << ".cache";
+
+        return path.str();
+    }
+
+    // checks the header written by the driver against the current device, the
+    // data of a different driver version would be silently ignored otherwise
+    bool checkPipelineCache(const std::vector<char> &data) const {
+        VkPhysicalDeviceProperties properties;
+        ::vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+
+        const size_t headerSize = 16 + VK_UUID_SIZE;
+
+        if (data.size() < headerSize) {
+            return false;
+        }
+
+        uint32_t header[4];
+        std::memcpy(header, data.data(), sizeof(header));
+
+        return header[0] >= headerSize 
+            && header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE 
+            && header[2] == properties.vendorID 
+            && header[3] == properties.deviceID 
+            && std::memcmp(data.data() + 16, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    }
+
+    VkPipelineCache createPipelineCache() {
+        std::vector<char> data;
+        std::ifstream file(this->getPipelineCachePath(), std::ios::binary);
+
+        if (file) {
+            data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+            if (!checkPipelineCache(data)) {
+                data.clear();
+            }
+        }
+
+        VkPipelineCacheCreateInfo createInfo = {};
+        createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        createInfo.initialDataSize = data.size();
+        createInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+        // the cache only saves time, so without one the pipelines get compiled from scratch
+        VkPipelineCache pipelineCache;
+        const VkResult result = ::vkCreatePipelineCache(m_device, &createInfo, m_allocator.callbacks(), &pipelineCache);
+
+        if (result != VK_SUCCESS) {
+            std::cerr << "vkCreatePipelineCache failed with VkResult " << result << ", running without a pipeline cache" << std::endl;
+            return VK_NULL_HANDLE;
+        }
+
+        return pipelineCache;
+    }
+
+    void savePipelineCache() const {
+        if (m_pipelineCache == VK_NULL_HANDLE) {
+            return;
+        }
+
+        size_t size = 0;
+
+        if (::vkGetPipelineCacheData(m_device, m_pipelineCache, &size, nullptr) != VK_SUCCESS || size == 0) {
+            return;
+        }
+
+        std::vector<char> data(size);
+
+        if (::vkGetPipelineCacheData(m_device, m_pipelineCache, &size, data.data()) != VK_SUCCESS) {
+            return;
+        }
+
+        // write to a temporary file first, so that an interrupted write can't leave a truncated cache
+        const std::string path = this->getPipelineCachePath();
+        const std::string temporaryPath = path + ".tmp";
+
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            file.write(data.data(), size);
+
+            if (!file) {
+                return;
+            }
+        }
+
+        std::remove(path.c_str());
+        std::rename(temporaryPath.c_str(), path.c_str());
+    }
+
+    uint32_t findMemoryType(const uint32_t typeBits, const VkMemoryPropertyFlags properties) const {
+        VkPhysicalDeviceMemoryProperties memoryProperties;
+
+        ::vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &memoryProperties);
+
+        for (uint32_t i=0; i<memoryProperties.memoryTypeCount; i++) {
+            if ((typeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+                return i;
+            }
+        }
+
+        throw std::runtime_error("no memory type is host visible and coherent");
+    }
+
+    // evaluates texture.comp into a host visible storage buffer and reads it back.
+    // 'dispatchSeconds' gets the time from submission to completion.
+    std::vector<float> computeTexture(const TextureParameters &parameters, double &dispatchSeconds) {
+        const VkDeviceSize size = sizeof(float) * parameters.width * parameters.height;
+
+        // the objects start out null and are destroyed on the way out, also when a call
+        // fails part way through: destroying a null handle does nothing
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+        VkShaderModule module = VK_NULL_HANDLE;
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+
+        const ScopeExit release([&]() {
+            ::vkDestroyFence(m_device, fence, m_allocator.callbacks());
+            ::vkDestroyCommandPool(m_device, commandPool, m_allocator.callbacks());
+            ::vkDestroyDescriptorPool(m_device, descriptorPool, m_allocator.callbacks());
+            ::vkDestroyPipeline(m_device, pipeline, m_allocator.callbacks());
+            ::vkDestroyShaderModule(m_device, module, m_allocator.callbacks());
+            ::vkDestroyPipelineLayout(m_device, pipelineLayout, m_allocator.callbacks());
+            ::vkDestroyDescriptorSetLayout(m_device, setLayout, m_allocator.callbacks());
+            ::vkDestroyBuffer(m_device, buffer, m_allocator.callbacks());
+            ::vkFreeMemory(m_device, memory, m_allocator.callbacks());
+        });
+
+        // storage buffer
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        check(::vkCreateBuffer(m_device, &bufferInfo, m_allocator.callbacks(), &buffer), "vkCreateBuffer");
+
+        VkMemoryRequirements requirements;
+        ::vkGetBufferMemoryRequirements(m_device, buffer, &requirements);
+
+        VkMemoryAllocateInfo allocateInfo = {};
+        allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocateInfo.allocationSize = requirements.size;
+        allocateInfo.memoryTypeIndex = this->findMemoryType(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+        check(::vkAllocateMemory(m_device, &allocateInfo, m_allocator.callbacks(), &memory), "vkAllocateMemory");
+
+        check(::vkBindBufferMemory(m_device, buffer, memory, 0), "vkBindBufferMemory");
+
+        m_timer.mark("storage buffer");
+
+        // pipeline: one storage buffer, and the parameters as push constants
+        VkDescriptorSetLayoutBinding binding = {};
+        binding.binding = 0;
+        binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        binding.descriptorCount = 1;
+        binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+        setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        setLayoutInfo.bindingCount = 1;
+        setLayoutInfo.pBindings = &binding;
+
+        check(::vkCreateDescriptorSetLayout(m_device, &setLayoutInfo, m_allocator.callbacks(), &setLayout), "vkCreateDescriptorSetLayout");
+
+        VkPushConstantRange pushConstants = {};
+        pushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstants.offset = 0;
+        pushConstants.size = sizeof(TextureParameters);
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &setLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstants;
+
+        check(::vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, m_allocator.callbacks(), &pipelineLayout), "vkCreatePipelineLayout");
+
+        VkShaderModuleCreateInfo moduleInfo = {};
+        moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        moduleInfo.codeSize = sizeof(texture_comp);
+        moduleInfo.pCode = texture_comp;
+
+        check(::vkCreateShaderModule(m_device, &moduleInfo, m_allocator.callbacks(), &module), "vkCreateShaderModule");
+
+        VkComputePipelineCreateInfo pipelineInfo = {};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = module;
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.layout = pipelineLayout;
+
+        check(::vkCreateComputePipelines(m_device, m_pipelineCache, 1, &pipelineInfo, m_allocator.callbacks(), &pipeline), "vkCreateComputePipelines");
+
+        m_timer.mark("compute pipeline");
+
+        // descriptor set pointing at the buffer
+        VkDescriptorPoolSize poolSize = {};
+        poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        poolSize.descriptorCount = 1;
+
+        VkDescriptorPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.maxSets = 1;
+        poolInfo.poolSizeCount = 1;
+        poolInfo.pPoolSizes = &poolSize;
+
+        check(::vkCreateDescriptorPool(m_device, &poolInfo, m_allocator.callbacks(), &descriptorPool), "vkCreateDescriptorPool");
+
+        VkDescriptorSetAllocateInfo setInfo = {};
+        setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        setInfo.descriptorPool = descriptorPool;
+        setInfo.descriptorSetCount = 1;
+        setInfo.pSetLayouts = &setLayout;
+
+        VkDescriptorSet descriptorSet;
+        check(::vkAllocateDescriptorSets(m_device, &setInfo, &descriptorSet), "vkAllocateDescriptorSets");
+
+        VkDescriptorBufferInfo descriptorBuffer = {};
+        descriptorBuffer.buffer = buffer;
+        descriptorBuffer.offset = 0;
+        descriptorBuffer.range = size;
+
+        VkWriteDescriptorSet write = {};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = descriptorSet;
+        write.dstBinding = 0;
+        write.descriptorCount = 1;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        write.pBufferInfo = &descriptorBuffer;
+
+        ::vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+
+        // record the dispatch, 16x16 invocations per workgroup
+        VkCommandPoolCreateInfo commandPoolInfo = {};
+        commandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        commandPoolInfo.queueFamilyIndex = m_familyIndex;
+
+        check(::vkCreateCommandPool(m_device, &commandPoolInfo, m_allocator.callbacks(), &commandPool), "vkCreateCommandPool");
+
+        VkCommandBufferAllocateInfo commandBufferInfo = {};
+        commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        commandBufferInfo.commandPool = commandPool;
+        commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        commandBufferInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer;
+        check(::vkAllocateCommandBuffers(m_device, &commandBufferInfo, &commandBuffer), "vkAllocateCommandBuffers");
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        check(::vkBeginCommandBuffer(commandBuffer, &beginInfo), "vkBeginCommandBuffer");
+        ::vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+        ::vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+        ::vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(TextureParameters), &parameters);
+        ::vkCmdDispatch(commandBuffer, (parameters.width + 15) / 16, (parameters.height + 15) / 16, 1);
+
+        // make the shader writes visible to the host
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+        ::vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        check(::vkEndCommandBuffer(commandBuffer), "vkEndCommandBuffer");
+
+        VkFenceCreateInfo fenceInfo = {};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+        check(::vkCreateFence(m_device, &fenceInfo, m_allocator.callbacks(), &fence), "vkCreateFence");
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+
+        const auto start = std::chrono::steady_clock::now();
+
+        check(::vkQueueSubmit(m_queue, 1, &submitInfo, fence), "vkQueueSubmit");
+
+        check(::vkWaitForFences(m_device, 1, &fence, VK_TRUE, UINT64_MAX), "vkWaitForFences");
+
+        dispatchSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // read back
+        std::vector<float> texels(parameters.width * parameters.height);
+
+        void *data = nullptr;
+        check(::vkMapMemory(m_device, memory, 0, size, 0, &data), "vkMapMemory");
+
+        std::memcpy(texels.data(), data, static_cast<size_t>(size));
+        ::vkUnmapMemory(m_device, memory);
+
+        return texels;
+    }
+
+    // renders the texture on the device and on the CPU, and compares both results
+    int runCompute() {
+        TextureParameters parameters = {};
+        parameters.width = 1024;
+        parameters.height = 1024;
+        parameters.frequency = 24.0f;
+        parameters.edge0 = 0.3f;
+        parameters.edge1 = 0.7f;
+
+        double gpuSeconds = 0.0;
+        const std::vector<float> gpu = this->computeTexture(parameters, gpuSeconds);
+
+        m_timer.display();
+        m_allocator.display();
+
+        const auto start = std::chrono::steady_clock::now();
+        const std::vector<float> cpu = renderTexture(parameters);
+        const double cpuSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        float maxError = 0.0f;
+
+        for (size_t i=0; i<cpu.size(); i++) {
+            maxError = std::max(maxError, std::abs(gpu[i] - cpu[i]));
+        }
+
+        VkPhysicalDeviceProperties properties;
+        ::vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+
+        const double megapixels = parameters.width * parameters.height / 1.0e6;
+
+        std::cout << "Device: " << properties.deviceName << std::endl;
+        std::cout << "\tdevice: " << megapixels / gpuSeconds << " Mpixels/s" << std::endl;
+        std::cout << "\tcpu: " << megapixels / cpuSeconds << " Mpixels/s" << std::endl;
+        std::cout << "\tmax error: " << maxError << std::endl;
+
+        // the device sine is only required to be within 2^-11 of the exact one
+        return maxError < 1e-3f ? 0 : 1;
+    }
+
 private:
+    // declared first, as it must outlive every object allocated through it
+    HostAllocator m_allocator;
+    bool m_headless = false;
+    bool m_verbose = false;
+    StartupTimer m_timer;
+    VkQueueFlags m_queueFlags = VK_QUEUE_GRAPHICS_BIT;
+#if defined(VULKAN01_WITH_GLFW)
     GLFWwindow *m_window = nullptr;
+#endif
     VkInstance m_instance = VK_NULL_HANDLE;
     VkPhysicalDevice m_physicalDevice = VK_NULL_HANDLE;
     VkDevice m_device = VK_NULL_HANDLE;
-    VkDebugReportCallbackEXT m_debugCallback;
+    VkPipelineCache m_pipelineCache = VK_NULL_HANDLE;
+    VkDebugReportCallbackEXT m_debugCallback = VK_NULL_HANDLE;
     int m_familyIndex = -1;
     VkQueue m_queue;
 };
 
 int main(int argc, char **argv) {
-    Application app;
-    return app.run();
+    bool headless = false;
+    bool verbose = false;
+
+    for (int i=1; i<argc; i++) {
+        const std::string arg = argv[i];
+
+        if (arg == "--headless") {
+            headless = true;
+        } else if (arg == "--verbose") {
+            verbose = true;
+        }
+    }
+
+#if !defined(VULKAN01_WITH_GLFW)
+    if (!headless) {
+        std::cerr << "Vulkan01 was built without GLFW, only --headless is available" << std::endl;
+        return 1;
+    }
+#endif
+
+    try {
+        Application app(headless, verbose);
+        return app.run();
+    } catch (const std::exception &exception) {
+        std::cerr << "Vulkan01: " << exception.what() << std::endl;
+        return 1;
+    }
 }